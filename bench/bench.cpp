@@ -0,0 +1,287 @@
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "../src/block_cache.hpp"
+#include "../src/decode_cache.hpp"
+#include "../src/initialize.hpp"
+#include "../src/instructions.hpp"
+#include "../src/jit.hpp"
+#include "../src/lockstep.hpp"
+#include "../src/rewind.hpp"
+#include "../src/save_state.hpp"
+#include "../src/screen.hpp"
+#include "../src/state.hpp"
+#include "../src/threaded.hpp"
+#include "../src/types.hpp"
+
+using namespace chip8;
+
+namespace {
+
+constexpr auto instruction_count = 50'000'000;
+
+/// A tight loop of register, index and skip instructions that never halts.
+auto const alu_program = std::vector<char>{
+  0x60, 0x00,        // 200: LD V0, 0x00
+  0x70, 0x01,        // 202: ADD V0, 0x01
+  (char)0x81, 0x04,  // 204: ADD V1, V0
+  (char)0x82, 0x13,  // 206: XOR V2, V1
+  (char)0x83, 0x26,  // 208: SHR V3, V2
+  (char)0x84, 0x35,  // 20A: SUB V4, V3
+  (char)0xA3, 0x00,  // 20C: LD I, 0x300
+  (char)0xF0, 0x1E,  // 20E: ADD I, V0
+  0x30, 0x00,        // 210: SE V0, 0x00
+  0x12, 0x02,        // 212: JP 0x202
+  0x12, 0x00,        // 214: JP 0x200
+};
+
+/// Draws a 15 row sprite at a moving position on every fourth instruction.
+auto const draw_program = std::vector<char>{
+  (char)0xA2, 0x00,  // 200: LD I, 0x200
+  0x70, 0x03,        // 202: ADD V0, 0x03
+  0x71, 0x01,        // 204: ADD V1, 0x01
+  (char)0xD0, 0x1F,  // 206: DRW V0, V1, 15
+  0x12, 0x02,        // 208: JP 0x202
+};
+
+auto const random_program = std::vector<char>{
+  (char)0xC0, (char)0xFF,  // 200: RND V0, 0xFF
+  (char)0x81, 0x04,        // 202: ADD V1, V0
+  0x12, 0x00,              // 204: JP 0x200
+};
+
+/// Run \p fn and print the time per instruction and the instruction rate.
+template <typename Fn>
+auto measure(std::string const& name, Fn&& fn) -> void
+{
+  auto const start   = Clock_t::now();
+  auto const checked = fn();
+  auto const elapsed =
+    std::chrono::duration<double, std::nano>(Clock_t::now() - start).count();
+  std::cout << std::left << std::setw(24) << name << std::right << std::fixed
+            << std::setprecision(2) << std::setw(8)
+            << elapsed / instruction_count << " ns/instruction"
+            << std::setw(10) << instruction_count / elapsed * 1'000.
+            << " MIPS  (checksum " << checked << ")\n";
+}
+
+auto bench_switch() -> int
+{
+  auto state = initialize_state(alu_program);
+  for (auto i = 0; i < instruction_count; ++i) {
+    state.program_counter =
+      process_instruction_switch(state, *get_instruction(state));
+  }
+  return state.index_register;
+}
+
+auto bench_dispatch_table() -> int
+{
+  auto state = initialize_state(alu_program);
+  for (auto i = 0; i < instruction_count; ++i) {
+    state.program_counter =
+      process_instruction(state, *get_instruction(state));
+  }
+  return state.index_register;
+}
+
+auto bench_draw() -> int
+{
+  auto state = initialize_state(draw_program);
+  for (auto i = 0; i < instruction_count; ++i) {
+    state.program_counter =
+      process_instruction(state, *get_instruction(state));
+  }
+  return state.general_purpose_registers[0xF];
+}
+
+auto bench_random() -> int
+{
+  auto state = initialize_state(random_program, 1);
+  for (auto i = 0; i < instruction_count; ++i) {
+    state.program_counter =
+      process_instruction(state, *get_instruction(state));
+  }
+  return state.general_purpose_registers[0x1];
+}
+
+auto bench_decode_cache() -> int
+{
+  auto state = initialize_state(alu_program);
+  auto cache = Decode_cache{};
+  for (auto i = 0; i < instruction_count; ++i) {
+    cache.step(state);
+  }
+  return state.index_register;
+}
+
+auto bench_block_cache() -> int
+{
+  auto state    = initialize_state(alu_program);
+  auto cache    = Block_cache{};
+  auto executed = 0;
+  while (executed < instruction_count) {
+    cache.run(state, [&](Instruction_t) { ++executed; });
+  }
+  return state.index_register;
+}
+
+#ifdef CHIP8_JIT
+auto bench_jit() -> int
+{
+  auto state    = initialize_state(alu_program);
+  auto jit      = Jit{};
+  auto executed = 0;
+  while (executed < instruction_count) {
+    jit.run(state, [&](Instruction_t) { ++executed; });
+  }
+  return state.index_register;
+}
+#endif
+
+#ifdef CHIP8_THREADED
+auto bench_threaded() -> int
+{
+  auto state       = initialize_state(alu_program);
+  auto interpreter = Threaded_interpreter{};
+  auto executed    = 0;
+  while (executed < instruction_count) {
+    interpreter.run(state, [&](Instruction_t) { ++executed; });
+  }
+  return state.index_register;
+}
+#endif
+
+/// Identical lanes never diverge, the best case for Lockstep_batch.
+auto bench_lockstep() -> int
+{
+  constexpr auto lanes = 256;
+  auto batch           = std::make_unique<Lockstep_batch<lanes>>(alu_program);
+  batch->run(instruction_count / lanes, 8);
+  return batch->state(lanes - 1).index_register;
+}
+
+/// Encode, then encode and write to /dev/null, the frames of draw_program.
+auto bench_render(std::string const& name, Render_mode mode) -> void
+{
+  constexpr auto frames = 200'000;
+  auto state            = initialize_state(draw_program);
+  auto const null       = ::open("/dev/null", O_WRONLY);
+  auto encoder          = Renderer{mode};
+  auto writer           = Renderer{mode, null};
+  auto encode_time      = std::chrono::nanoseconds{0};
+  auto present_time     = std::chrono::nanoseconds{0};
+  auto bytes            = std::uint64_t{0};
+  for (auto frame = 0; frame < frames; ++frame) {
+    // Two sprites per frame.
+    for (auto i = 0; i < 8; ++i) {
+      state.program_counter =
+        process_instruction(state, *get_instruction(state));
+    }
+    auto const start = Clock_t::now();
+    bytes += encoder.encode(state.screen_buffer).size();
+    auto const encoded = Clock_t::now();
+    writer.present(state.screen_buffer);
+    present_time += Clock_t::now() - encoded;
+    encode_time += encoded - start;
+  }
+  ::close(null);
+  auto const per_frame = [](auto total) { return double(total) / frames; };
+  std::cout << std::left << std::setw(24) << name << std::right
+            << std::fixed << std::setprecision(2) << std::setw(8)
+            << per_frame(encode_time.count()) << " ns/frame encode"
+            << std::setw(10) << per_frame(present_time.count())
+            << " ns/frame present  " << per_frame(bytes) << " bytes/frame  "
+            << per_frame(writer.stats().write_calls) << " writes/frame\n";
+}
+
+/// Encode and decode a save state of the machine running draw_program.
+auto bench_save_state() -> void
+{
+  constexpr auto rounds = 100'000;
+  auto state            = initialize_state(draw_program, 1);
+  auto buffer           = Save_state_t{};
+  auto encode_time      = std::chrono::nanoseconds{0};
+  auto decode_time      = std::chrono::nanoseconds{0};
+  for (auto round = 0; round < rounds; ++round) {
+    state.program_counter =
+      process_instruction(state, *get_instruction(state));
+    auto const start = Clock_t::now();
+    encode_state(state, buffer);
+    auto const encoded = Clock_t::now();
+    decode_state(buffer, state);
+    decode_time += Clock_t::now() - encoded;
+    encode_time += encoded - start;
+  }
+  auto const per_round = [](auto total) { return double(total) / rounds; };
+  std::cout << std::left << std::setw(24) << "Save state" << std::right
+            << std::fixed << std::setprecision(2) << std::setw(8)
+            << per_round(encode_time.count()) << " ns encode" << std::setw(10)
+            << per_round(decode_time.count()) << " ns decode  "
+            << save_state_size << " bytes\n";
+}
+
+/// Capture every frame of draw_program, then step back through all of them.
+auto bench_rewind() -> void
+{
+  constexpr auto frames = 100'000;
+  auto state            = initialize_state(draw_program, 1);
+  auto rewind           = Rewind_buffer{};
+  auto const start      = Clock_t::now();
+  for (auto frame = 0; frame < frames; ++frame) {
+    for (auto i = 0; i < 8; ++i) {
+      state.program_counter =
+        process_instruction(state, *get_instruction(state));
+    }
+    rewind.capture(state);
+  }
+  auto const captured = Clock_t::now();
+  auto const held     = rewind.frames();
+  auto const bytes    = rewind.bytes_used();
+  rewind.rewind(held, state);
+  auto const rewound   = Clock_t::now();
+  auto const per_frame = [](auto total, auto count) {
+    return double(total) / double(count);
+  };
+  std::cout << std::left << std::setw(24) << "Rewind_buffer" << std::right
+            << std::fixed << std::setprecision(2) << std::setw(8)
+            << per_frame((captured - start).count(), frames)
+            << " ns/frame capture" << std::setw(10)
+            << per_frame((rewound - captured).count(), held)
+            << " ns/frame rewind  " << per_frame(bytes, held)
+            << " bytes/frame  " << held << " frames held\n";
+}
+
+}  // namespace
+
+auto main() -> int
+{
+  measure("switch", bench_switch);
+  measure("dispatch_table", bench_dispatch_table);
+  measure("dispatch_table DRW", bench_draw);
+  measure("dispatch_table RND", bench_random);
+  measure("Decode_cache", bench_decode_cache);
+  measure("Block_cache", bench_block_cache);
+#ifdef CHIP8_JIT
+  measure("Jit", bench_jit);
+#endif
+#ifdef CHIP8_THREADED
+  measure("Threaded_interpreter", bench_threaded);
+#endif
+  measure("Lockstep_batch x256", bench_lockstep);
+  bench_render("Renderer halfblock", Render_mode::Half_block);
+  bench_render("Renderer braille", Render_mode::Braille);
+  bench_render("Renderer sextant", Render_mode::Sextant);
+  bench_render("Renderer sixel", Render_mode::Sixel);
+  bench_save_state();
+  bench_rewind();
+  return 0;
+}
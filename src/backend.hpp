@@ -0,0 +1,74 @@
+#ifndef BACKEND_HPP
+#define BACKEND_HPP
+#include <stdexcept>
+#include <string>
+
+#include "block_cache.hpp"
+#include "decode_cache.hpp"
+#include "instructions.hpp"
+#include "jit.hpp"
+#include "threaded.hpp"
+#include "state.hpp"
+#include "types.hpp"
+
+namespace chip8 {
+
+/// Execution backends, all produce the same State for the same program.
+/** Each backend provides `run(State&, on_executed) -> bool`, executing one or
+ *  more instructions per call and reporting each through on_executed, and
+ *  `clear()`, forgetting what it cached of State::memory after the memory is
+ *  replaced. */
+enum class Backend { Interpreter, Decode_cache, Block_cache, Jit, Threaded };
+
+/// Executes one instruction per call through process_instruction.
+struct Interpreter {
+  template <typename Fn>
+  auto run(State& state, Fn&& on_executed) -> bool
+  {
+    auto const instruction = get_instruction(state);
+    if (!instruction.has_value()) {
+      return false;
+    }
+    state.program_counter = process_instruction(state, *instruction);
+    on_executed(*instruction);
+    return true;
+  }
+
+  /// Nothing is cached, see Decode_cache::clear().
+  auto clear() -> void {}
+};
+
+/// Throws std::runtime_error if \p name is not a known backend.
+inline auto parse_backend(std::string const& name) -> Backend
+{
+  if (name == "interpreter") {
+    return Backend::Interpreter;
+  }
+  if (name == "cache") {
+    return Backend::Decode_cache;
+  }
+  if (name == "block") {
+    return Backend::Block_cache;
+  }
+  if (name == "jit") {
+#ifdef CHIP8_JIT
+    return Backend::Jit;
+#else
+    throw std::runtime_error{"--backend jit requires building with CHIP8_JIT."};
+#endif
+  }
+  if (name == "threaded") {
+#ifdef CHIP8_THREADED
+    return Backend::Threaded;
+#else
+    throw std::runtime_error{
+      "--backend threaded requires building with CHIP8_THREADED."};
+#endif
+  }
+  throw std::runtime_error{
+    "Unknown --backend: " + name +
+    ", expected interpreter, cache, block, jit or threaded."};
+}
+
+}  // namespace chip8
+#endif  // BACKEND_HPP
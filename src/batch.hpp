@@ -0,0 +1,187 @@
+#ifndef BATCH_HPP
+#define BATCH_HPP
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <ios>
+#include <memory>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "headless.hpp"
+#include "initialize.hpp"
+#include "save_state.hpp"
+#include "state.hpp"
+#include "thread_pool.hpp"
+
+namespace chip8 {
+
+/// A program to run as one machine of a batch.
+struct Batch_job {
+  std::string name;  // Identifies the job in the summary, usually a ROM path.
+  std::vector<char> program;
+  std::optional<std::uint64_t> seed;  // Overrides Batch_options::seed.
+  std::optional<Save_state_t> initial_state;  // Resume from here, not boot.
+  std::optional<std::string> save_state_filepath;  // Written at the end.
+};
+
+/// Outcome of one Batch_job.
+struct Batch_result {
+  std::string name;
+  Headless_report report;
+  std::uint64_t framebuffer_hash = 0;
+  std::optional<std::uint64_t> seed;  // The machine's, if it was seeded.
+};
+
+struct Batch_options {
+  std::uint64_t cycle_limit      = 0;
+  std::uint64_t cycles_per_frame = 1;
+  std::uint64_t slice_cycles     = 10'000;
+  std::size_t thread_count       = std::thread::hardware_concurrency();
+  /// Job i without a seed of its own draws from seed + i, as lane i of a
+  /// Lockstep_batch does.
+  std::optional<std::uint64_t> seed;
+};
+
+/// Return the seed job \p index of a batch draws from, see Batch_options.
+inline auto batch_seed(Batch_job const& job,
+                       std::optional<std::uint64_t> seed,
+                       std::size_t index) -> std::optional<std::uint64_t>
+{
+  if (job.seed) {
+    return job.seed;
+  }
+  return seed ? std::optional{*seed + index} : std::nullopt;
+}
+
+namespace detail {
+
+template <typename Backend_t>
+struct Batch_machine {
+  State state;
+  Backend_t backend;
+  Batch_result result;
+  std::optional<std::string> save_state_filepath;
+};
+
+/// Run \p machine for one slice, then queue its next slice on \p pool.
+template <typename Backend_t>
+auto run_slice(Work_stealing_pool& pool,
+               Batch_machine<Backend_t>& machine,
+               Batch_options const& options) -> void
+{
+  auto& report     = machine.result.report;
+  auto const limit = std::min(report.instructions + options.slice_cycles,
+                              options.cycle_limit);
+  auto const start = std::chrono::steady_clock::now();
+  auto running     = false;
+  try {
+    running = resume_headless(machine.state, machine.backend, report, limit,
+                              options.cycles_per_frame);
+  }
+  catch (std::exception const& e) {
+    report.halt_reason = e.what();
+  }
+  report.elapsed += std::chrono::steady_clock::now() - start;
+  if (running && report.instructions < options.cycle_limit) {
+    pool.submit([&pool, &machine, &options] {
+      run_slice(pool, machine, options);
+    });
+    return;
+  }
+  machine.result.framebuffer_hash = framebuffer_hash(machine.state);
+  if (machine.save_state_filepath) {
+    try {
+      save_state(machine.state, *machine.save_state_filepath);
+    }
+    catch (std::exception const& e) {
+      report.halt_reason +=
+        (report.halt_reason.empty() ? "" : "; ") + std::string{e.what()};
+    }
+  }
+}
+
+}  // namespace detail
+
+/// Run every job as its own machine on a Work_stealing_pool.
+/** Each machine is a headless run, see resume_headless(), executed in slices
+ *  of options.slice_cycles instructions so idle workers can pick up machines
+ *  queued behind long running ones. \p make_backend is called once per job
+ *  and returns that machine's execution backend. A job with an initial_state
+ *  resumes from it, a job with a save_state_filepath writes its final State
+ *  there. A job that fails to load, throws while running or fails to save is
+ *  reported through its halt_reason. Results are in the same order as
+ *  \p jobs. */
+template <typename Make_backend>
+auto run_batch(std::vector<Batch_job> const& jobs,
+               Batch_options const& options,
+               Make_backend&& make_backend) -> std::vector<Batch_result>
+{
+  using Machine = detail::Batch_machine<decltype(make_backend())>;
+  auto machines = std::vector<std::unique_ptr<Machine>>{};
+  machines.reserve(jobs.size());
+  {
+    auto pool = Work_stealing_pool{options.thread_count};
+    for (auto i = std::size_t{0}; i < jobs.size(); ++i) {
+      auto const& job = jobs[i];
+      auto& machine   = *machines.emplace_back(new Machine{
+        State{}, make_backend(), Batch_result{}, std::nullopt});
+      machine.result.name         = job.name;
+      machine.result.seed         = batch_seed(job, options.seed, i);
+      machine.save_state_filepath = job.save_state_filepath;
+      try {
+        machine.state = initialize_state(job.program, machine.result.seed);
+        if (job.initial_state) {
+          decode_state(*job.initial_state, machine.state);
+        }
+      }
+      catch (std::exception const& e) {
+        machine.result.report.halt_reason = e.what();
+        continue;
+      }
+      pool.submit([&pool, &machine, &options] {
+        detail::run_slice(pool, machine, options);
+      });
+    }
+    pool.wait();
+  }
+  auto results = std::vector<Batch_result>{};
+  results.reserve(machines.size());
+  for (auto& machine : machines) {
+    results.push_back(std::move(machine->result));
+  }
+  return results;
+}
+
+/// Write one tab separated line per result, after a header line. The seed is
+/// "-" for machines on Random_generator::default_seed.
+inline auto write_summary(std::ostream& os,
+                          std::vector<Batch_result> const& results)
+  -> std::ostream&
+{
+  os << "rom\tseed\tinstructions\tframes\tframebuffer_hash\thalt_reason\n";
+  for (auto const& result : results) {
+    auto const& report = result.report;
+    os << std::dec << result.name << '\t';
+    if (result.seed) {
+      os << *result.seed;
+    }
+    else {
+      os << '-';
+    }
+    os << '\t' << report.instructions << '\t' << report.frames << '\t'
+       << std::hex << "0x" << result.framebuffer_hash << '\t'
+       << (report.halt_reason.empty() ? "-" : report.halt_reason) << '\n';
+  }
+  os << std::dec;
+  os.flush();
+  return os;
+}
+
+}  // namespace chip8
+#endif  // BATCH_HPP
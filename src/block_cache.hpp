@@ -0,0 +1,144 @@
+#ifndef BLOCK_CACHE_HPP
+#define BLOCK_CACHE_HPP
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <utility>
+#include <vector>
+
+#include "constants.hpp"
+#include "decode_cache.hpp"
+#include "instructions.hpp"
+#include "state.hpp"
+#include "types.hpp"
+
+namespace chip8 {
+
+/// A straight-line run of decoded instructions starting at \p start.
+/** Only the last instruction may change control flow or write to memory. */
+struct Block {
+  Address_t start;
+  Address_t end;  // One past the last byte of the last instruction.
+  std::vector<Decoded_instruction> instructions;
+};
+
+/// Return true if \p instruction must be the last instruction in a Block.
+/** Blocks end at jumps, calls, returns and skips, and at the instructions that
+ *  write memory or wait for input. They end at Dxyn too, so a block draws at
+ *  most once and State::sprite_x is still its draw's after the block. */
+inline auto ends_block(Instruction_t instruction) -> bool
+{
+  switch (opcode(instruction)) {
+    case 0x0: return instruction == 0x00EE;
+    case 0x1:
+    case 0x2:
+    case 0x3:
+    case 0x4:
+    case 0x5:
+    case 0x9:
+    case 0xB:
+    case 0xD:
+    case 0xE: return true;
+    case 0xF:
+      switch (kk(instruction)) {
+        case 0x0A:
+        case 0x33:
+        case 0x55: return true;
+      }
+      return false;
+  }
+  return false;
+}
+
+/// Translates guest code into Blocks and caches them by start address.
+/** Executing a Block leaves State exactly as process_instruction would after
+ *  the same instructions. Blocks overlapping memory written by Fx33 and Fx55
+ *  are discarded. Writes made directly to State::memory are not seen, call
+ *  clear() after making them. */
+class Block_cache {
+ public:
+  /// Upper bound on the number of instructions in a single Block.
+  static constexpr auto max_block_length = std::size_t{32};
+
+ public:
+  Block_cache() : blocks_(MEMORY_AMOUNT) {}
+
+ public:
+  /// Execute the Block at the program counter, calling \p on_executed with
+  /// each instruction word after it has run. Returns false without executing
+  /// anything if the program counter points to an invalid address.
+  template <typename Fn>
+  auto run(State& state, Fn&& on_executed) -> bool
+  {
+    auto const* block = this->translate(state);
+    if (block == nullptr) {
+      return false;
+    }
+    for (auto const& decoded : block->instructions) {
+      state.program_counter = decoded.handler(state, decoded.instruction);
+      on_executed(decoded.instruction);
+    }
+    auto const [first, count] =
+      memory_write_range(state, block->instructions.back().instruction);
+    if (count != 0) {
+      // Last use of block, it may be destroyed here.
+      this->invalidate(first, count);
+    }
+    return true;
+  }
+
+  /// Return the Block starting at the program counter, translating it if it is
+  /// not cached. Returns nullptr if the program counter is invalid.
+  auto translate(State const& state) -> Block const*
+  {
+    auto const start = state.program_counter;
+    if (std::size_t{start} + 1 >= MEMORY_AMOUNT) {
+      return nullptr;
+    }
+    auto& block = blocks_[start];
+    if (block.has_value()) {
+      return &*block;
+    }
+    block.emplace(Block{start, start, {}});
+    auto& instructions = block->instructions;
+    auto address       = start;
+    while (std::size_t{address} + 1 < MEMORY_AMOUNT &&
+           instructions.size() < max_block_length) {
+      auto const instruction = Instruction_t(
+        (std::uint16_t(state.memory[address]) << 8) |
+        state.memory[address + 1]);
+      instructions.push_back({decode(instruction), instruction});
+      address += 2;
+      if (ends_block(instruction)) {
+        break;
+      }
+    }
+    block->end = address;
+    return &*block;
+  }
+
+  /// Discard every Block overlapping [first, first+count).
+  auto invalidate(Address_t first, std::size_t count) -> void
+  {
+    auto const last = std::min<std::size_t>(first + count, MEMORY_AMOUNT);
+    // A block covering first cannot start more than its maximum size before.
+    auto const window = max_block_length * 2 - 1;
+    auto const begin  = first > window ? first - window : std::size_t{0};
+    for (auto start = begin; start < last; ++start) {
+      auto& block = blocks_[start];
+      if (block.has_value() && block->end > first) {
+        block.reset();
+      }
+    }
+  }
+
+  /// Discard all Blocks.
+  auto clear() -> void { std::ranges::fill(blocks_, std::nullopt); }
+
+ private:
+  std::vector<std::optional<Block>> blocks_;
+};
+
+}  // namespace chip8
+#endif  // BLOCK_CACHE_HPP
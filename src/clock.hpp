@@ -1,32 +1,136 @@
 #ifndef CLOCK_HPP
 #define CLOCK_HPP
+#include <array>
 #include <chrono>
+#include <cstddef>
 #include <cstdint>
-#include <functional>
 #include <optional>
 
 #include "types.hpp"
 
 namespace chip8 {
 
-inline auto emulated_clock(Instruction_t instruction)
-  -> std::chrono::microseconds
+/// One machine cycle of the COSMAC VIP, eight periods of its 1.7609MHz clock.
+inline constexpr auto vip_machine_cycle = std::chrono::nanoseconds{4543};
+
+/// COSMAC VIP interpreter cost of \p instruction, in machine cycles.
+/** Averages over the interpreter's code paths, after
+ *  https://jackson-s.me/2019/07/13/Chip-8-Instruction-Scheduling-and-Frequency.html
+ *  Fx55 and Fx65 loop once per register. Dxyn is the cost of an aligned
+ *  sprite, vip_sprite_shift_cycles adds the rest. */
+constexpr auto vip_cycles(Instruction_t instruction) -> std::uint16_t
 {
-  // TODO
-  // https://jackson-s.me/2019/07/13/Chip-8-Instruction-Scheduling-and-Frequency.html
-  return std::chrono::microseconds{1000000 / 500};
+  auto const x  = (instruction >> 8) & 0xF;
+  auto const n  = instruction & 0xF;
+  auto const kk = instruction & 0xFF;
+  switch (instruction >> 12) {
+    case 0x0:
+      switch (instruction) {
+        case 0x00E0: return 24;
+        case 0x00EE: return 23;
+      }
+      return 23;  // Machine code subroutine, charged as a call.
+    case 0x1:
+    case 0x2: return 23;
+    case 0x3:
+    case 0x4: return 12;
+    case 0x5: return 16;
+    case 0x6: return 6;
+    case 0x7: return 10;
+    case 0x8: return 44;
+    case 0x9: return 16;
+    case 0xA: return 12;
+    case 0xB: return 23;
+    case 0xC: return 36;
+    case 0xD: return std::uint16_t(26 + 17 * n);
+    case 0xE: return 16;
+    case 0xF:
+      switch (kk) {
+        case 0x07:
+        case 0x0A:  // Per poll of the keypad.
+        case 0x15:
+        case 0x18: return 10;
+        case 0x1E: return 19;
+        case 0x29: return 20;
+        case 0x33: return 204;
+        case 0x55:
+        case 0x65: return std::uint16_t(7 + 14 * (x + 1));
+      }
+      return 10;
+  }
+  return 0;
 }
 
-/// If clock_hz is nullopt, default to emulated per opcode averages.
+/// vip_cycles of every instruction, indexed by the instruction.
+inline constexpr auto vip_cycle_table = [] {
+  auto table = std::array<std::uint16_t, 0x10000>{};
+  for (auto i = std::size_t{0}; i < table.size(); ++i) {
+    table[i] = vip_cycles(static_cast<Instruction_t>(i));
+  }
+  return table;
+}();
+
+/// Machine cycles the VIP adds to each sprite row drawn at column x, indexed
+/// by x % 8.
+/** An unaligned row is shifted right one bit at a time and spans two bytes of
+ *  display memory. */
+inline constexpr auto vip_sprite_shift_cycles = [] {
+  auto table = std::array<std::uint16_t, 8>{};
+  for (auto shift = std::size_t{1}; shift < table.size(); ++shift) {
+    table[shift] = std::uint16_t(12 + 4 * shift);
+  }
+  return table;
+}();
+
+/// Returns the time the emulated machine takes to execute an instruction.
+/** Either a fixed rate or the COSMAC VIP timing, both without an indirect
+ *  call per instruction. */
+class Instruction_clock {
+ public:
+  /// Time instructions as the COSMAC VIP does.
+  Instruction_clock() = default;
+
+  /// Every instruction takes one period of \p hz.
+  explicit Instruction_clock(std::uint16_t hz)
+    : period_{std::chrono::nanoseconds{std::chrono::seconds{1}} / hz}
+  {}
+
+ public:
+  /// Return the time \p instruction takes, \p sprite_x is the x coordinate
+  /// a Dxyn drew at, see State::sprite_x, which decides its alignment.
+  auto operator()(Instruction_t instruction, std::uint8_t sprite_x) const
+    -> std::chrono::nanoseconds
+  {
+    if (period_.count() != 0) {
+      return period_;
+    }
+    auto cycles = std::uint32_t{vip_cycle_table[instruction]};
+    if ((instruction >> 12) == 0xD) {
+      cycles += (instruction & 0xF) * vip_sprite_shift_cycles[sprite_x % 8];
+    }
+    return cycles * vip_machine_cycle;
+  }
+
+  /// Return true if \p instruction first waits for the display interrupt.
+  /** The VIP interpreter draws sprites during vertical blank, so a Dxyn
+   *  starts at the next 60Hz frame. */
+  auto waits_for_vblank(Instruction_t instruction) const -> bool
+  {
+    return period_.count() == 0 && (instruction >> 12) == 0xD;
+  }
+
+ private:
+  std::chrono::nanoseconds period_{0};  // Zero for the VIP timing.
+};
+
+/// If clock_hz is nullopt, time instructions as the COSMAC VIP does.
 inline auto make_clock_fn(std::optional<std::uint16_t> clock_hz)
-  -> std::function<std::chrono::microseconds(Instruction_t)>
+  -> Instruction_clock
 {
-  if (!clock_hz.has_value()) {
-    return emulated_clock;
+  if (!clock_hz.has_value() || *clock_hz == 0) {
+    return Instruction_clock{};
   }
-  return [hz = *clock_hz](Instruction_t) {
-    return std::chrono::microseconds{1000000 / hz};
-  };
+  return Instruction_clock{*clock_hz};
 }
 
 }  // namespace chip8
@@ -1,8 +1,10 @@
 #ifndef CHIP8_DEBUG_HPP
 #define CHIP8_DEBUG_HPP
+#include <cstddef>
 #include <ios>
 #include <ostream>
 
+#include "framebuffer.hpp"
 #include "state.hpp"
 #include "types.hpp"
 
@@ -12,7 +14,7 @@ inline auto write_stack(std::ostream& os, std::array<Address_t, 16> stack)
   -> void
 {
   os << "Instruction Stack:\n";
-  for (auto i = 0; i < stack.size(); ++i) {
+  for (auto i = std::size_t{0}; i < stack.size(); ++i) {
     os << "\t0x" << i << " 0x" << stack[i] << '\n';
   }
 }
@@ -21,7 +23,7 @@ inline auto write_registers(std::ostream& os,
                             std::array<std::uint8_t, 16> registers) -> void
 {
   os << "Registers:\n";
-  for (auto i = 0; i < registers.size(); ++i) {
+  for (auto i = std::size_t{0}; i < registers.size(); ++i) {
     os << "\tV" << i << " 0x" << (int)registers[i] << '\n';
   }
 }
@@ -64,9 +66,10 @@ inline auto print_memory(std::ostream& os,
 
 inline auto print_screen_state(std::ostream& os, State const& state) -> void
 {
-  for (auto const& row : state.screen_buffer) {
-    for (bool const pixel : row) {
-      os << (pixel ? 'X' : '_');
+  auto const& screen = state.screen_buffer;
+  for (auto y = std::size_t{0}; y < Framebuffer::height; ++y) {
+    for (auto x = std::size_t{0}; x < Framebuffer::width; ++x) {
+      os << (screen.pixel(x, y) ? 'X' : '_');
     }
     os << std::endl;
   }
@@ -0,0 +1,94 @@
+#ifndef DECODE_CACHE_HPP
+#define DECODE_CACHE_HPP
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+
+#include "constants.hpp"
+#include "instructions.hpp"
+#include "state.hpp"
+#include "types.hpp"
+
+namespace chip8 {
+
+/// An instruction word along with the handler that executes it.
+struct Decoded_instruction {
+  Handler_t handler = nullptr;  // nullptr until the entry is decoded.
+  Instruction_t instruction = 0;
+};
+
+/// Caches the decoded instruction for each even address in State::memory.
+/** Entries are decoded the first time they are executed and reused after
+ *  that. Memory written by Fx33 and Fx55 is invalidated so self-modifying
+ *  programs behave the same as with process_instruction. Writes made directly
+ *  to State::memory are not seen, call clear() after making them. */
+class Decode_cache {
+ public:
+  /// Execute the instruction at the program counter and update the program
+  /// counter. Returns the executed instruction, or std::nullopt if the program
+  /// counter points to an invalid address.
+  auto step(State& state) -> std::optional<Instruction_t>
+  {
+    auto const pc = state.program_counter;
+    if (std::size_t{pc} + 1 >= MEMORY_AMOUNT) {
+      return std::nullopt;
+    }
+    auto instruction = Instruction_t{0};
+    if (pc % 2 != 0) {
+      // Misaligned code is rare, decode it every time.
+      instruction           = *get_instruction(state);
+      state.program_counter = process_instruction(state, instruction);
+    }
+    else {
+      auto& entry = entries_[pc / 2];
+      if (entry.handler == nullptr) {
+        entry.instruction = *get_instruction(state);
+        entry.handler     = decode(entry.instruction);
+      }
+      instruction           = entry.instruction;
+      state.program_counter = entry.handler(state, instruction);
+    }
+
+    auto const [first, count] = memory_write_range(state, instruction);
+    if (count != 0) {
+      this->invalidate(first, count);
+    }
+    return instruction;
+  }
+
+  /// Execute one instruction and call \p on_executed with it. Returns false
+  /// without executing anything if the program counter is invalid.
+  template <typename Fn>
+  auto run(State& state, Fn&& on_executed) -> bool
+  {
+    auto const instruction = this->step(state);
+    if (!instruction.has_value()) {
+      return false;
+    }
+    on_executed(*instruction);
+    return true;
+  }
+
+  /// Discard the entries of any instruction overlapping [first, first+count).
+  auto invalidate(Address_t first, std::size_t count) -> void
+  {
+    // An instruction at an even address covers that address and the next.
+    auto const begin = std::min<std::size_t>(first, MEMORY_AMOUNT) / 2;
+    auto const end =
+      std::min<std::size_t>(first + count + 1, MEMORY_AMOUNT) / 2;
+    for (auto i = begin; i < end; ++i) {
+      entries_[i] = Decoded_instruction{};
+    }
+  }
+
+  /// Discard all entries.
+  auto clear() -> void { entries_.fill(Decoded_instruction{}); }
+
+ private:
+  std::array<Decoded_instruction, MEMORY_AMOUNT / 2> entries_{};
+};
+
+}  // namespace chip8
+#endif  // DECODE_CACHE_HPP
@@ -0,0 +1,61 @@
+#ifndef FRAMEBUFFER_HPP
+#define FRAMEBUFFER_HPP
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+
+namespace chip8 {
+
+/// 64x32 monochrome display, one bit per pixel.
+/** Each row is a single word with the leftmost pixel in the most significant
+ *  bit, so a sprite row is drawn with one rotate and one XOR. */
+class Framebuffer {
+ public:
+  using Row_t = std::uint64_t;
+
+  static constexpr auto width  = std::size_t{64};
+  static constexpr auto height = std::size_t{32};
+
+ public:
+  /// Return true if the pixel at column \p x and row \p y is lit.
+  constexpr auto pixel(std::size_t x, std::size_t y) const -> bool
+  {
+    return (rows_[y] >> (width - 1 - x)) & 1;
+  }
+
+  /// Return row \p y, the leftmost pixel is the most significant bit.
+  constexpr auto row(std::size_t y) const -> Row_t { return rows_[y]; }
+
+  constexpr auto rows() const -> std::array<Row_t, height> const&
+  {
+    return rows_;
+  }
+
+  /// Replace row \p y, the leftmost pixel is the most significant bit.
+  constexpr auto set_row(std::size_t y, Row_t row) -> void { rows_[y] = row; }
+
+  /// XOR the eight pixels of \p sprite_row onto row \p y, starting at column
+  /// \p x and wrapping around the right edge.
+  /** Returns true if any lit pixel was turned off. */
+  constexpr auto draw_row(std::size_t y, std::size_t x, std::uint8_t sprite_row)
+    -> bool
+  {
+    auto const bits = std::rotr(Row_t{sprite_row} << (width - 8), int(x));
+    auto& row       = rows_[y];
+    auto const hit  = (row & bits) != 0;
+    row ^= bits;
+    return hit;
+  }
+
+  /// Turn every pixel off.
+  constexpr auto clear() -> void { rows_ = {}; }
+
+  constexpr auto operator==(Framebuffer const&) const -> bool = default;
+
+ private:
+  std::array<Row_t, height> rows_{};
+};
+
+}  // namespace chip8
+#endif  // FRAMEBUFFER_HPP
@@ -0,0 +1,147 @@
+#ifndef HEADLESS_HPP
+#define HEADLESS_HPP
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <ios>
+#include <ostream>
+#include <string>
+
+#include "debug.hpp"
+#include "keyboard.hpp"
+#include "framebuffer.hpp"
+#include "idle.hpp"
+#include "state.hpp"
+#include "timer.hpp"
+#include "types.hpp"
+
+namespace chip8 {
+
+/// Outcome of run_headless.
+struct Headless_report {
+  std::uint64_t instructions = 0;
+  std::uint64_t frames       = 0;
+  std::chrono::nanoseconds elapsed{0};
+  std::string halt_reason;  // Empty if the run reached its cycle limit.
+};
+
+/// FNV-1a hash of the screen buffer.
+/** Pixels are packed eight to a byte, left to right and top to bottom, with
+ *  the leftmost pixel in the most significant bit. */
+inline auto framebuffer_hash(State const& state) -> std::uint64_t
+{
+  auto hash = std::uint64_t{0xcbf29ce484222325};
+  for (auto const row : state.screen_buffer.rows()) {
+    for (auto shift = int{Framebuffer::width}; shift > 0; shift -= 8) {
+      auto const byte = std::uint8_t(row >> (shift - 8));
+      hash            = (hash ^ byte) * 0x100000001b3;
+    }
+  }
+  return hash;
+}
+
+/// Continue a headless run of \p state on \p backend until at least
+/// \p cycle_limit instructions have executed in total or the program halts.
+/** Returns false once the program has halted, with the reason recorded in
+ *  \p report. Timers count down once every \p cycles_per_frame instructions
+ *  instead of following the host clock, so runs are reproducible. Idle loops,
+ *  see find_idle_loop(), are counted through to the next frame instead of
+ *  run. The keyboard is detached, a program waiting on Fx0A halts. Does not
+ *  update Headless_report::elapsed. */
+template <typename Backend_t>
+auto resume_headless(State& state,
+                     Backend_t& backend,
+                     Headless_report& report,
+                     std::uint64_t cycle_limit,
+                     std::uint64_t cycles_per_frame) -> bool
+{
+  state.keyboard.detach();
+  auto next_frame        = (report.frames + 1) * cycles_per_frame;
+  auto idle              = Idle_detector{};
+  auto const on_executed = [&](Instruction_t instruction) {
+    ++report.instructions;
+    idle.on_executed(instruction);
+  };
+  try {
+    while (report.instructions < cycle_limit) {
+      if (!backend.run(state, on_executed)) {
+        report.halt_reason = "invalid program counter";
+        return false;
+      }
+      if (auto const loop = idle.check(state)) {
+        // Count whole iterations up to the next frame without running them,
+        // each leaves State as it was.
+        auto const until = std::min(next_frame, cycle_limit);
+        if (until > report.instructions) {
+          report.instructions += (until - report.instructions) / *loop * *loop;
+        }
+      }
+      while (report.instructions >= next_frame) {
+        tick_timer(state.delay_timer_register);
+        tick_timer(state.sound_timer_register);
+        ++report.frames;
+        next_frame += cycles_per_frame;
+      }
+    }
+  }
+  catch (Detached_keyboard_error const&) {
+    report.halt_reason = "waiting for a keypress";
+    return false;
+  }
+  return true;
+}
+
+/// Run \p state on \p backend as fast as the host allows, until at least
+/// \p cycle_limit instructions have executed or the program halts.
+/** See resume_headless(). */
+template <typename Backend_t>
+auto run_headless(State& state,
+                  Backend_t& backend,
+                  std::uint64_t cycle_limit,
+                  std::uint64_t cycles_per_frame) -> Headless_report
+{
+  auto report      = Headless_report{};
+  auto const start = std::chrono::steady_clock::now();
+  resume_headless(state, backend, report, cycle_limit, cycles_per_frame);
+  report.elapsed = std::chrono::steady_clock::now() - start;
+  return report;
+}
+
+/// Write the throughput, framebuffer hash and registers after a headless run.
+inline auto write_report(std::ostream& os,
+                         Headless_report const& report,
+                         State const& state) -> std::ostream&
+{
+  auto const seconds = std::chrono::duration<double>{report.elapsed}.count();
+  auto const mips =
+    seconds > 0 ? double(report.instructions) / seconds / 1'000'000 : 0.0;
+  os << std::dec;
+  os << "Instructions:     " << report.instructions << '\n';
+  os << "Frames:           " << report.frames << '\n';
+  os << "Elapsed:          " << seconds << " s\n";
+  os << "MIPS:             " << mips << '\n';
+  if (!report.halt_reason.empty()) {
+    os << "Halted:           " << report.halt_reason << '\n';
+  }
+  os << std::hex;
+  os << "Framebuffer Hash: "
+     << "0x" << framebuffer_hash(state) << '\n';
+  write_registers(os, state.general_purpose_registers);
+  os << "Index Register:   "
+     << "0x" << state.index_register << '\n';
+  os << "Program Counter:  "
+     << "0x" << state.program_counter << '\n';
+  os << "Delay Timer:      "
+     << "0x" << (int)state.delay_timer_register.value << '\n';
+  os << "Sound Timer:      "
+     << "0x" << (int)state.sound_timer_register.value << '\n';
+  os << "Stack Pointer:    "
+     << "0x" << (int)state.stack_pointer << '\n';
+  os << std::dec;
+  os.flush();
+  return os;
+}
+
+}  // namespace chip8
+#endif  // HEADLESS_HPP
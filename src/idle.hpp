@@ -0,0 +1,106 @@
+#ifndef IDLE_HPP
+#define IDLE_HPP
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+
+#include "constants.hpp"
+#include "state.hpp"
+#include "types.hpp"
+
+namespace chip8 {
+
+/// Longest loop, in instructions per iteration, find_idle_loop() looks for.
+inline constexpr auto max_idle_loop = std::size_t{8};
+
+/// Return the instructions per iteration of the loop \p state is spinning in,
+/// std::nullopt if it is not spinning.
+/** A loop spins if one iteration from the program counter, with the timers
+ *  and the keys as they are now, brings the program counter back and leaves
+ *  every register as it was, such as `Fx07; 3x00; 1nnn` polling the delay
+ *  timer or a `1nnn` jumping to itself. Until a timer or a key changes, every
+ *  further iteration does the same, so whole iterations can be skipped. Only
+ *  loops of jumps, skips, Fx07, Ex9E, ExA1 and 6xkk are recognized. */
+inline auto find_idle_loop(State const& state) -> std::optional<std::size_t>
+{
+  auto const start = state.program_counter;
+  auto reg         = state.general_purpose_registers;
+  auto pc          = start;
+  for (auto length = std::size_t{1}; length <= max_idle_loop; ++length) {
+    if (pc + 1u >= MEMORY_AMOUNT) {
+      return std::nullopt;
+    }
+    auto const instruction =
+      Instruction_t((state.memory[pc] << 8) | state.memory[pc + 1]);
+    auto const x    = (instruction >> 8) & 0xF;
+    auto const y    = (instruction >> 4) & 0xF;
+    auto const kk   = std::uint8_t(instruction & 0xFF);
+    auto const skip = [&](bool condition) { pc += condition ? 4 : 2; };
+    switch (instruction >> 12) {
+      case 0x1: pc = instruction & 0x0FFF; break;
+      case 0x3: skip(reg[x] == kk); break;
+      case 0x4: skip(reg[x] != kk); break;
+      case 0x5:
+      case 0x9:
+        if ((instruction & 0xF) != 0) {
+          return std::nullopt;
+        }
+        skip((reg[x] == reg[y]) == (instruction >> 12 == 0x5));
+        break;
+      case 0x6:
+        reg[x] = kk;
+        pc += 2;
+        break;
+      case 0xE:
+        if (kk != 0x9E && kk != 0xA1) {
+          return std::nullopt;
+        }
+        skip(state.keyboard.is_pressed(reg[x]) == (kk == 0x9E));
+        break;
+      case 0xF:
+        if (kk != 0x07) {
+          return std::nullopt;
+        }
+        reg[x] = state.delay_timer_register.value;
+        pc += 2;
+        break;
+      default: return std::nullopt;
+    }
+    if (pc == start) {
+      return reg == state.general_purpose_registers
+               ? std::optional{length}
+               : std::nullopt;
+    }
+  }
+  return std::nullopt;
+}
+
+/// Decides when to look for an idle loop, see find_idle_loop().
+/** Looking after every instruction would slow down backends that run one
+ *  instruction at a time, so it looks only after a jump, which every loop
+ *  takes once per iteration, or after a run of several instructions. */
+class Idle_detector {
+ public:
+  /// Call with each instruction executed.
+  auto on_executed(Instruction_t instruction) -> void
+  {
+    last_ = instruction;
+    ++executed_;
+  }
+
+  /// Call after each Backend run, returns what find_idle_loop() does.
+  auto check(State const& state) -> std::optional<std::size_t>
+  {
+    auto const look = executed_ > 1 || (last_ >> 12) == 0x1;
+    executed_       = 0;
+    return look ? find_idle_loop(state) : std::nullopt;
+  }
+
+ private:
+  Instruction_t last_     = 0;
+  std::uint64_t executed_ = 0;
+};
+
+}  // namespace chip8
+#endif  // IDLE_HPP
@@ -6,12 +6,15 @@
 #include <cstdint>
 #include <fstream>
 #include <iterator>
+#include <optional>
 #include <sstream>
 #include <stdexcept>
 #include <string>
 #include <vector>
 
 #include "constants.hpp"
+#include "framebuffer.hpp"
+#include "random.hpp"
 #include "state.hpp"
 #include "types.hpp"
 
@@ -53,16 +56,16 @@ inline auto initialize_digit_sprites(
   }
 }
 
-inline auto initialize_screen(std::array<std::array<bool, 64>, 32>& screen)
-  -> void
+inline auto initialize_screen(Framebuffer& screen) -> void
 {
-  using std::ranges::fill;
-  for (auto& row : screen) {
-    fill(row, false);
-  }
+  screen.clear();
 }
 
-inline auto initialize_state(std::vector<char> const& program) -> State
+/// Return a machine with \p program loaded. Its random numbers are drawn from
+/// \p seed, or from Random_generator::default_seed if it is nullopt.
+inline auto initialize_state(std::vector<char> const& program,
+                             std::optional<std::uint64_t> seed = std::nullopt)
+  -> State
 {
   using std::ranges::fill;
   if (program.size() > MEMORY_AMOUNT - INSTRUCTION_OFFSET) {
@@ -86,6 +89,10 @@ inline auto initialize_state(std::vector<char> const& program) -> State
   state.sound_timer_register.previous_update = Clock_t::now();
   state.sound_timer_register.rate = std::chrono::microseconds{1000000 / 60};
 
+  if (seed.has_value()) {
+    state.random_generator = Random_generator{*seed};
+  }
+
   return state;
 }
 
@@ -0,0 +1,179 @@
+#ifndef INPUT_THREAD_HPP
+#define INPUT_THREAD_HPP
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <thread>
+#include <type_traits>
+#include <variant>
+
+#include <esc/event.hpp>
+#include <esc/io.hpp>
+
+#include "keyboard.hpp"
+#include "types.hpp"
+
+namespace chip8 {
+
+/// Keys the keypad does not use that control the emulator instead.
+enum class Host_key { Save_state, Rewind };
+
+inline constexpr auto host_key_count = std::size_t{2};
+
+/// Return the Host_key that \p key maps to, std::nullopt if it maps to none.
+inline auto host_key(esc::Key key) -> std::optional<Host_key>
+{
+  switch (key) {
+    using esc::Key;
+    case Key::p: return Host_key::Save_state;
+    case Key::Backspace: return Host_key::Rewind;
+    default: return std::nullopt;
+  }
+}
+
+/// Tracks which keys are held from terminal key presses.
+/** Reading key release events from terminal is a pain and requires superuser,
+ *  so each key is released \p auto_release after its last press instead.
+ *  Important that auto-repeat keys overlap to provide illusion of continuous
+ *  key press. Keys time out independently, any number can be held at once.
+ *  Release events, where the terminal sends them, release a key at once. */
+class Held_keys {
+ public:
+  using Duration_t = std::chrono::milliseconds;
+
+ public:
+  explicit Held_keys(Duration_t auto_release) : auto_release_{auto_release} {}
+
+ public:
+  /// Hold \p key until \p now + auto_release.
+  auto press(std::uint8_t key, Clock_t::time_point now) -> void
+  {
+    mask_ |= Key_mask(1u << key);
+    release_at_[key] = now + auto_release_;
+  }
+
+  auto release(std::uint8_t key) -> void { mask_ &= Key_mask(~(1u << key)); }
+
+  /// Release the keys whose auto_release has run out by \p now.
+  auto expire(Clock_t::time_point now) -> void
+  {
+    for (auto key = std::uint8_t{0}; key < release_at_.size(); ++key) {
+      if (release_at_[key] <= now) {
+        this->release(key);
+      }
+    }
+  }
+
+  /// Return the time from \p now until the next key is released, at most
+  /// \p limit.
+  auto next_release(Clock_t::time_point now, Duration_t limit) const
+    -> Duration_t
+  {
+    auto result = limit;
+    for (auto key = std::uint8_t{0}; key < release_at_.size(); ++key) {
+      if ((mask_ >> key) & 1) {
+        auto const left = std::chrono::ceil<Duration_t>(release_at_[key] - now);
+        result          = std::clamp(left, Duration_t{0}, result);
+      }
+    }
+    return result;
+  }
+
+  auto mask() const -> Key_mask { return mask_; }
+
+ private:
+  Duration_t auto_release_;
+  std::array<Clock_t::time_point, 16> release_at_{};
+  Key_mask mask_ = 0;
+};
+
+/// Reads the terminal on a thread of its own and publishes the keys held.
+/** Attach a Keyboard to keys(), the emulation thread then reads keys with a
+ *  load instead of a read of STDIN per instruction. */
+class Input_thread {
+ public:
+  static constexpr auto default_auto_release = Held_keys::Duration_t{75};
+
+  /// Longest wait for input with no key held, bounds how long stop() takes.
+  static constexpr auto idle_poll = Held_keys::Duration_t{50};
+
+ public:
+  explicit Input_thread(
+    Held_keys::Duration_t auto_release = default_auto_release)
+    : held_{auto_release}, thread_{[this] { this->read(); }}
+  {}
+
+  Input_thread(Input_thread const&)                    = delete;
+  auto operator=(Input_thread const&) -> Input_thread& = delete;
+
+  ~Input_thread() { this->stop(); }
+
+ public:
+  /// Bit k is set while chip8 key k is held.
+  auto keys() const -> std::atomic<Key_mask> const& { return keys_; }
+
+  /// Return the presses of \p key since the last call.
+  auto take_presses(Host_key key) -> std::uint32_t
+  {
+    return presses_[std::size_t(key)].exchange(0, std::memory_order_relaxed);
+  }
+
+  /// Stop reading the terminal, returns within idle_poll.
+  auto stop() -> void
+  {
+    if (thread_.joinable()) {
+      stopping_.store(true, std::memory_order_relaxed);
+      thread_.join();
+    }
+  }
+
+ private:
+  auto read() -> void
+  {
+    while (!stopping_.load(std::memory_order_relaxed)) {
+      auto const timeout = held_.next_release(Clock_t::now(), idle_poll);
+      if (auto const event = esc::read(int(timeout.count()))) {
+        this->apply(*event);
+      }
+      held_.expire(Clock_t::now());
+      keys_.store(held_.mask(), std::memory_order_relaxed);
+    }
+  }
+
+  auto apply(esc::Event const& event) -> void
+  {
+    std::visit(
+      [this](auto const& e) {
+        using T = std::decay_t<decltype(e)>;
+        if constexpr (std::is_same_v<T, esc::Key_press>) {
+          if (auto const key = chip8_key(e.key)) {
+            held_.press(*key, Clock_t::now());
+          }
+          else if (auto const host = host_key(e.key)) {
+            presses_[std::size_t(*host)].fetch_add(1,
+                                                   std::memory_order_relaxed);
+          }
+        }
+        else if constexpr (std::is_same_v<T, esc::Key_release>) {
+          if (auto const key = chip8_key(e.key)) {
+            held_.release(*key);
+          }
+        }
+      },
+      event);
+  }
+
+ private:
+  Held_keys held_;  // Used only by the input thread while it runs.
+  std::atomic<Key_mask> keys_ = 0;
+  std::array<std::atomic<std::uint32_t>, host_key_count> presses_{};
+  std::atomic<bool> stopping_ = false;
+  std::thread thread_;  // Last, it uses the members above.
+};
+
+}  // namespace chip8
+#endif  // INPUT_THREAD_HPP
@@ -1,61 +1,62 @@
 #ifndef INSTRUCTIONS_HPP
 #define INSTRUCTIONS_HPP
 #include <algorithm>
+#include <array>
 #include <bitset>
+#include <cstddef>
 #include <cstdint>
 #include <iostream>
 #include <limits>
 #include <optional>
-#include <random>
 #include <sstream>
 #include <stdexcept>
 #include <string>
+#include <type_traits>
 #include <utility>
 
 #include "constants.hpp"
 #include "initialize.hpp"
 #include "keyboard.hpp"
+#include "framebuffer.hpp"
 #include "state.hpp"
 #include "types.hpp"
 
 namespace {  // FIXME this is a header, anon namespace not right
 using namespace chip8;
 
-inline auto opcode(Instruction_t instruction) -> std::uint8_t
+constexpr auto opcode(Instruction_t instruction) -> std::uint8_t
 {
   return instruction >> 12;
 }
 
-inline auto x(Instruction_t instruction) -> std::uint8_t
+constexpr auto x(Instruction_t instruction) -> std::uint8_t
 {
   return (instruction & 0x0F00) >> 8;
 }
 
-inline auto y(Instruction_t instruction) -> std::uint8_t
+constexpr auto y(Instruction_t instruction) -> std::uint8_t
 {
   return (instruction & 0x00F0) >> 4;
 }
 
-inline auto n(Instruction_t instruction) -> std::uint8_t
+constexpr auto n(Instruction_t instruction) -> std::uint8_t
 {
   return instruction & 0x000F;
 }
 
-inline auto nnn(Instruction_t instruction) -> std::uint16_t
+constexpr auto nnn(Instruction_t instruction) -> std::uint16_t
 {
   return instruction & 0x0FFF;
 }
 
-inline auto kk(Instruction_t instruction) -> std::uint8_t
+constexpr auto kk(Instruction_t instruction) -> std::uint8_t
 {
   return instruction & 0x00FF;
 }
 
 inline auto clear_display(State& state) -> void
 {
-  for (auto& row : state.screen_buffer) {
-    std::ranges::fill(row, false);
-  }
+  state.screen_buffer.clear();
 }
 
 inline auto subroutine_return(State& state) -> void
@@ -104,9 +105,6 @@ inline auto skip_if_not_equal_rb(State& state, Instruction_t instruction)
 /// Skip the next instruction if Vx == Vy
 inline auto skip_if_equal_rr(State& state, Instruction_t instruction) -> void
 {
-  if (n(instruction) != 0) {
-    throw unknown_instruction_exception(instruction);
-  }
   auto& reg = state.general_purpose_registers;
   if (reg[x(instruction)] == reg[y(instruction)])
     state.program_counter += 2;
@@ -116,9 +114,6 @@ inline auto skip_if_equal_rr(State& state, Instruction_t instruction) -> void
 inline auto skip_if_not_equal_rr(State& state, Instruction_t instruction)
   -> void
 {
-  if (n(instruction) != 0) {
-    throw unknown_instruction_exception(instruction);
-  }
   auto& reg = state.general_purpose_registers;
   if (reg[x(instruction)] != reg[y(instruction)])
     state.program_counter += 2;
@@ -220,9 +215,7 @@ inline auto jump_to_nnn_plus_v0(State& state, Instruction_t instruction) -> void
 inline auto random_byte(State& state, Instruction_t instruction) -> void
 {
   auto& reg           = state.general_purpose_registers;
-  auto rng            = std::mt19937{std::random_device{}()};
-  auto dist           = std::uniform_int_distribution{0, 255};
-  reg[x(instruction)] = dist(rng) & kk(instruction);
+  reg[x(instruction)] = state.random_generator.next_byte() & kk(instruction);
 }
 
 inline auto display_sprite(State& state, Instruction_t instruction) -> void
@@ -232,21 +225,13 @@ inline auto display_sprite(State& state, Instruction_t instruction) -> void
   auto const length   = n(instruction);
   auto const location = state.index_register;
   auto vf             = 0x0;
+  state.sprite_x      = at.first;
 
   for (auto i = Address_t{0x0}; i < length; ++i) {
-    auto const bits = state.memory[location + i];
-    for (auto j = 0x0; j < 8; ++j) {
-      auto const screen_y = (at.second + i) % 32;
-      auto const screen_x = (at.first + j) % 64;
-
-      bool& pixel          = state.screen_buffer[screen_y][screen_x];
-      bool const new_pixel = bits & (0x1 << (7 - j));
-      // bool const new_pixel = 0x1 & (bits >> j);
-
-      if (pixel && new_pixel) {
-        vf = 0x1;
-      }
-      pixel ^= new_pixel;
+    auto const screen_y = (at.second + i) % Framebuffer::height;
+    if (state.screen_buffer.draw_row(screen_y, at.first % Framebuffer::width,
+                                     state.memory[location + i])) {
+      vf = 0x1;
     }
   }
   state.general_purpose_registers[0xF] = vf;
@@ -254,20 +239,16 @@ inline auto display_sprite(State& state, Instruction_t instruction) -> void
 
 inline auto skip_if_pressed(State& state, Instruction_t instruction) -> void
 {
-  auto& reg              = state.general_purpose_registers;
-  auto const key         = reg[x(instruction)];
-  auto const key_pressed = state.keyboard.get_state();
-  if (key_pressed.has_value() && key_pressed.value() == key) {
+  auto& reg = state.general_purpose_registers;
+  if (state.keyboard.is_pressed(reg[x(instruction)])) {
     state.program_counter += 2;
   }
 }
 
 inline auto skip_if_not_pressed(State& state, Instruction_t instruction) -> void
 {
-  auto& reg              = state.general_purpose_registers;
-  auto const key         = reg[x(instruction)];
-  auto const key_pressed = state.keyboard.get_state();
-  if (!key_pressed.has_value() || key_pressed.value() != key) {
+  auto& reg = state.general_purpose_registers;
+  if (!state.keyboard.is_pressed(reg[x(instruction)])) {
     state.program_counter += 2;
   }
 }
@@ -279,26 +260,31 @@ inline auto set_from_delay_timer(State& state, Instruction_t instruction)
   reg[x(instruction)] = state.delay_timer_register.value;
 }
 
+/// Store the lowest key held in Vx. With no key held the machine waits, the
+/// program counter stays on Fx0A and State::waiting_for_key is set.
 inline auto wait_for_keypress(State& state, Instruction_t instruction) -> void
 {
-  auto& reg           = state.general_purpose_registers;
-  auto key            = state.keyboard.get_state_blocking();
-  reg[x(instruction)] = key;
-  state.program_counter += 2;
+  auto& reg = state.general_purpose_registers;
+  if (auto const key = state.keyboard.get_key()) {
+    reg[x(instruction)]   = *key;
+    state.waiting_for_key = false;
+    state.program_counter += 2;
+  }
+  else {
+    state.waiting_for_key = true;  // Fx0A runs again.
+  }
 }
 
 inline auto set_delay_timer(State& state, Instruction_t instruction) -> void
 {
-  auto& reg                                  = state.general_purpose_registers;
-  state.delay_timer_register.value           = reg[x(instruction)];
-  state.delay_timer_register.previous_update = Clock_t::now();
+  auto& reg                        = state.general_purpose_registers;
+  state.delay_timer_register.value = reg[x(instruction)];
 }
 
 inline auto set_sound_timer(State& state, Instruction_t instruction) -> void
 {
-  auto& reg                                  = state.general_purpose_registers;
-  state.sound_timer_register.value           = reg[x(instruction)];
-  state.sound_timer_register.previous_update = Clock_t::now();
+  auto& reg                        = state.general_purpose_registers;
+  state.sound_timer_register.value = reg[x(instruction)];
 }
 
 inline auto add_to_index_register(State& state, Instruction_t instruction)
@@ -346,15 +332,115 @@ inline auto memory_to_registers(State& state, Instruction_t instruction) -> void
   }
 }
 
+template <auto Fn>
+inline auto invoke_instruction(State& state, Instruction_t instruction) -> void
+{
+  if constexpr (std::is_invocable_v<decltype(Fn), State&>) {
+    Fn(state);
+  }
+  else {
+    Fn(state, instruction);
+  }
+}
+
+/// Handler adaptor for instructions that fall through to the next address.
+template <auto Fn>
+inline auto then_advance(State& state, Instruction_t instruction) -> Address_t
+{
+  invoke_instruction<Fn>(state, instruction);
+  return state.program_counter + 2;
+}
+
+/// Handler adaptor for instructions that set the program counter themselves.
+template <auto Fn>
+inline auto then_jump(State& state, Instruction_t instruction) -> Address_t
+{
+  invoke_instruction<Fn>(state, instruction);
+  return state.program_counter;
+}
+
+inline auto system_call(State&, Instruction_t) -> void
+{
+  // System machine code jump, not used in emulated environment.
+}
+
+inline auto trap(State&, Instruction_t instruction) -> Address_t
+{
+  throw unknown_instruction_exception(instruction);
+}
+
+/// Return the handler dispatch_table holds for \p instruction. Encodings
+/// process_instruction_switch rejects map directly to trap.
+constexpr auto make_handler(Instruction_t instruction) -> Handler_t
+{
+  switch (opcode(instruction)) {
+    case 0x0:
+      if (instruction == 0x00E0) {
+        return then_advance<clear_display>;
+      }
+      if (instruction == 0x00EE) {
+        return then_advance<subroutine_return>;
+      }
+      return then_advance<system_call>;
+    case 0x1: return then_jump<jump_to_address>;
+    case 0x2: return then_jump<call_subroutine>;
+    case 0x3: return then_advance<skip_if_equal_rb>;
+    case 0x4: return then_advance<skip_if_not_equal_rb>;
+    case 0x5:
+      return n(instruction) == 0 ? then_advance<skip_if_equal_rr> : trap;
+    case 0x6: return then_advance<set_register>;
+    case 0x7: return then_advance<add_register>;
+    case 0x8:
+      switch (n(instruction)) {
+        case 0x0: return then_advance<load_y_to_x>;
+        case 0x1: return then_advance<bitwise_or>;
+        case 0x2: return then_advance<bitwise_and>;
+        case 0x3: return then_advance<bitwise_xor>;
+        case 0x4: return then_advance<add_with_carry>;
+        case 0x5: return then_advance<subtract_with_not_borrow>;
+        case 0x6: return then_advance<shift_right>;
+        case 0x7: return then_advance<rsubtract_with_not_borrow>;
+        case 0xE: return then_advance<shift_left>;
+      }
+      return then_advance<system_call>;
+    case 0x9:
+      return n(instruction) == 0 ? then_advance<skip_if_not_equal_rr> : trap;
+    case 0xA: return then_advance<set_index_register>;
+    case 0xB: return then_jump<jump_to_nnn_plus_v0>;
+    case 0xC: return then_advance<random_byte>;
+    case 0xD: return then_advance<display_sprite>;
+    case 0xE:
+      switch (kk(instruction)) {
+        case 0x9E: return then_advance<skip_if_pressed>;
+        case 0xA1: return then_advance<skip_if_not_pressed>;
+      }
+      return trap;
+    case 0xF:
+      switch (kk(instruction)) {
+        case 0x07: return then_advance<set_from_delay_timer>;
+        case 0x0A: return then_jump<wait_for_keypress>;
+        case 0x15: return then_advance<set_delay_timer>;
+        case 0x18: return then_advance<set_sound_timer>;
+        case 0x1E: return then_advance<add_to_index_register>;
+        case 0x29: return then_advance<set_index_register_to_digit_sprite>;
+        case 0x33: return then_advance<store_bcd_representation>;
+        case 0x55: return then_advance<registers_to_memory>;
+        case 0x65: return then_advance<memory_to_registers>;
+      }
+      return trap;
+  }
+  return trap;
+}
+
 }  // namespace
 
 namespace chip8 {
 
-/// Return the next program counter address.
-inline auto process_instruction(State& state, Instruction_t instruction)
+/// Decodes with a switch on every call, the reference dispatch_table is
+/// checked against. Return the next program counter address.
+inline auto process_instruction_switch(State& state, Instruction_t instruction)
   -> Address_t
 {
-  // print_registers(state);
   switch (opcode(instruction)) {
     case 0x0:
       if (instruction == 0x00E0) {
@@ -371,7 +457,12 @@ inline auto process_instruction(State& state, Instruction_t instruction)
     case 0x2: call_subroutine(state, instruction); return state.program_counter;
     case 0x3: skip_if_equal_rb(state, instruction); break;
     case 0x4: skip_if_not_equal_rb(state, instruction); break;
-    case 0x5: skip_if_equal_rr(state, instruction); break;
+    case 0x5:
+      if (n(instruction) != 0) {
+        throw unknown_instruction_exception(instruction);
+      }
+      skip_if_equal_rr(state, instruction);
+      break;
     case 0x6: set_register(state, instruction); break;
     case 0x7: add_register(state, instruction); break;
     case 0x8:
@@ -387,7 +478,12 @@ inline auto process_instruction(State& state, Instruction_t instruction)
         case 0xE: shift_left(state, instruction); break;
       }
       break;
-    case 0x9: skip_if_not_equal_rr(state, instruction); break;
+    case 0x9:
+      if (n(instruction) != 0) {
+        throw unknown_instruction_exception(instruction);
+      }
+      skip_if_not_equal_rr(state, instruction);
+      break;
     case 0xA: set_index_register(state, instruction); break;
     case 0xB:
       jump_to_nnn_plus_v0(state, instruction);
@@ -422,11 +518,49 @@ inline auto process_instruction(State& state, Instruction_t instruction)
   return state.program_counter + 2;
 }
 
+/// Handler for every instruction word, see make_handler().
+inline constexpr auto dispatch_table = [] {
+  auto table = std::array<Handler_t, 0x10000>{};
+  for (auto i = std::size_t{0}; i < table.size(); ++i) {
+    table[i] = make_handler(static_cast<Instruction_t>(i));
+  }
+  return table;
+}();
+
+/// Return the next program counter address.
+inline auto process_instruction(State& state, Instruction_t instruction)
+  -> Address_t
+{
+  return dispatch_table[instruction](state, instruction);
+}
+
+/// Return the handler that process_instruction would run for \p instruction.
+/** Resolving the handler once and calling it many times is equivalent to
+ *  calling process_instruction each time; see Decode_cache. */
+inline auto decode(Instruction_t instruction) -> Handler_t
+{
+  return dispatch_table[instruction];
+}
+
+/// Return the range of memory that \p instruction writes to as {first, count}.
+/** Only Fx33 and Fx55 write to memory, count is zero for everything else.
+ *  Neither instruction modifies the index register, so this can be called
+ *  before or after the instruction is executed. */
+inline auto memory_write_range(State const& state, Instruction_t instruction)
+  -> std::pair<Address_t, std::size_t>
+{
+  switch (instruction & 0xF0FF) {
+    case 0xF033: return {state.index_register, 3};
+    case 0xF055: return {state.index_register, x(instruction) + 1u};
+  }
+  return {state.index_register, 0};
+}
+
 /// Return the 2 byte instruction at the current program counter.
 /// Return std::nullopt if the program counter points to an invalid address.
 inline auto get_instruction(State const& state) -> std::optional<Instruction_t>
 {
-  if (state.program_counter + 1 >= state.memory.size()) {
+  if (std::size_t{state.program_counter} + 1 >= state.memory.size()) {
     return std::nullopt;
   }
   return (std::uint16_t(state.memory[state.program_counter]) << 8) |
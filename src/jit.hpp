@@ -0,0 +1,644 @@
+#ifndef JIT_HPP
+#define JIT_HPP
+#ifdef CHIP8_JIT
+#  if !defined(__x86_64__) || !defined(__unix__)
+#    error "CHIP8_JIT requires an x86-64 POSIX host."
+#  endif
+#  include <algorithm>
+#  include <array>
+#  include <cstddef>
+#  include <cstdint>
+#  include <cstring>
+#  include <exception>
+#  include <initializer_list>
+#  include <stdexcept>
+#  include <utility>
+#  include <vector>
+
+#  include <sys/mman.h>
+
+#  include "block_cache.hpp"
+#  include "constants.hpp"
+#  include "instructions.hpp"
+#  include "state.hpp"
+#  include "types.hpp"
+
+namespace chip8 {
+
+/// Minimal x86-64 encoder for the instructions the Jit emits.
+/** Memory operands are always [r15 + disp32], r15 holds the State pointer. */
+class X86_emitter {
+ public:
+  enum Reg : std::uint8_t {
+    rax = 0, rcx = 1, rdx = 2, rbx = 3, rsp = 4, rbp = 5, rsi = 6, rdi = 7,
+    r8 = 8, r12 = 12, r13 = 13, r14 = 14, r15 = 15,
+  };
+
+  enum class Width { Byte, Word, Dword, Qword };
+
+  /// Either a host register or a byte offset into State.
+  struct Operand {
+    bool is_register;
+    std::uint8_t reg;
+    std::int32_t disp;
+  };
+
+  static auto reg(Reg r) -> Operand { return {true, r, 0}; }
+
+  static auto mem(std::size_t disp) -> Operand
+  {
+    return {false, r15, static_cast<std::int32_t>(disp)};
+  }
+
+ public:
+  auto bytes() const -> std::vector<std::uint8_t> const& { return bytes_; }
+
+  auto emit(std::initializer_list<std::uint8_t> bytes) -> void
+  {
+    bytes_.insert(std::end(bytes_), bytes);
+  }
+
+  auto emit32(std::uint32_t value) -> void
+  {
+    for (auto i = 0; i < 4; ++i) {
+      bytes_.push_back(static_cast<std::uint8_t>(value >> (i * 8)));
+    }
+  }
+
+  auto emit64(std::uint64_t value) -> void
+  {
+    this->emit32(static_cast<std::uint32_t>(value));
+    this->emit32(static_cast<std::uint32_t>(value >> 32));
+  }
+
+  /// Emit [66] [REX] opcode ModRM [disp32]. \p reg is the ModRM reg field,
+  /// either a register or an opcode extension.
+  auto op(std::initializer_list<std::uint8_t> opcode,
+          std::uint8_t reg,
+          Operand rm,
+          Width width) -> void
+  {
+    if (width == Width::Word) {
+      bytes_.push_back(0x66);
+    }
+    auto rex = std::uint8_t{0x40};
+    if (width == Width::Qword) {
+      rex |= 0x08;
+    }
+    if (reg & 8) {
+      rex |= 0x04;
+    }
+    if (rm.reg & 8) {
+      rex |= 0x01;
+    }
+    // spl, bpl, sil and dil are only reachable with a REX prefix.
+    auto const needs_rex =
+      width == Width::Byte &&
+      ((reg >= 4 && reg < 8) || (rm.is_register && rm.reg >= 4 && rm.reg < 8));
+    if (rex != 0x40 || needs_rex) {
+      bytes_.push_back(rex);
+    }
+    bytes_.insert(std::end(bytes_), opcode);
+    if (rm.is_register) {
+      bytes_.push_back(0xC0 | ((reg & 7) << 3) | (rm.reg & 7));
+    }
+    else {
+      bytes_.push_back(0x80 | ((reg & 7) << 3) | (rm.reg & 7));
+      this->emit32(static_cast<std::uint32_t>(rm.disp));
+    }
+  }
+
+  /// mov r32, imm32
+  auto mov_imm32(Reg r, std::uint32_t value) -> void
+  {
+    if (r & 8) {
+      bytes_.push_back(0x41);
+    }
+    bytes_.push_back(0xB8 + (r & 7));
+    this->emit32(value);
+  }
+
+  /// mov r64, imm64
+  auto mov_imm64(Reg r, std::uint64_t value) -> void
+  {
+    bytes_.push_back((r & 8) ? 0x49 : 0x48);
+    bytes_.push_back(0xB8 + (r & 7));
+    this->emit64(value);
+  }
+
+  /// Emit a jcc rel8 with an unknown target, returns the position to patch.
+  auto jump8(std::uint8_t opcode) -> std::size_t
+  {
+    this->emit({opcode, 0x00});
+    return bytes_.size();
+  }
+
+  /// Point the jump returned by jump8 at the current position.
+  auto patch8(std::size_t from) -> void
+  {
+    auto const distance = bytes_.size() - from;
+    if (distance > 127) {
+      throw std::logic_error{"X86_emitter: rel8 jump out of range."};
+    }
+    bytes_[from - 1] = static_cast<std::uint8_t>(distance);
+  }
+
+ private:
+  std::vector<std::uint8_t> bytes_;
+};
+
+/// Executable memory the Jit writes compiled blocks into.
+/** The mapping is only writable while code is being copied into it. */
+class Code_buffer {
+ public:
+  static constexpr auto capacity = std::size_t{1} << 20;
+
+ public:
+  Code_buffer()
+    : memory_{::mmap(nullptr, capacity, PROT_READ | PROT_EXEC,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)}
+  {
+    if (memory_ == MAP_FAILED) {
+      throw std::runtime_error{"Code_buffer: mmap failed."};
+    }
+  }
+
+  Code_buffer(Code_buffer const&)                    = delete;
+  auto operator=(Code_buffer const&) -> Code_buffer& = delete;
+
+  ~Code_buffer() { ::munmap(memory_, capacity); }
+
+ public:
+  /// Copy \p code into the buffer, returns nullptr if there is no room left.
+  auto write(std::vector<std::uint8_t> const& code) -> void*
+  {
+    if (used_ + code.size() > capacity) {
+      return nullptr;
+    }
+    auto* const at = static_cast<std::uint8_t*>(memory_) + used_;
+    ::mprotect(memory_, capacity, PROT_READ | PROT_WRITE);
+    std::memcpy(at, code.data(), code.size());
+    ::mprotect(memory_, capacity, PROT_READ | PROT_EXEC);
+    // Keep blocks 16 byte aligned.
+    used_ += (code.size() + 15) & ~std::size_t{15};
+    return at;
+  }
+
+  /// Release all code, previously returned pointers become invalid.
+  auto reset() -> void { used_ = 0; }
+
+ private:
+  void* memory_;
+  std::size_t used_ = 0;
+};
+
+/// Recompiles hot Blocks to native x86-64 code.
+/** Blocks are interpreted until they have run compile_threshold times. While a
+ *  compiled block runs, the most used V registers and the index register live
+ *  in host registers; instructions without a native translation call their
+ *  handler from instructions.hpp. Memory written by Fx33 and Fx55 discards the
+ *  compiled code covering it, it is recompiled once it is hot again. */
+class Jit {
+ public:
+  /// Number of interpreted runs before a Block is compiled.
+  static constexpr auto compile_threshold = 8;
+
+ public:
+  /// Execute the Block at the program counter, calling \p on_executed with
+  /// each instruction word after the block has run. Returns false without
+  /// executing anything if the program counter points to an invalid address.
+  template <typename Fn>
+  auto run(State& state, Fn&& on_executed) -> bool
+  {
+    auto const* block = blocks_.translate(state);
+    if (block == nullptr) {
+      return false;
+    }
+    auto& compiled = compiled_[block->start];
+    if (compiled.code == nullptr && ++compiled.runs >= compile_threshold) {
+      compiled.code = this->compile(*block);
+      compiled.end  = block->end;
+    }
+    try {
+      if (compiled.code != nullptr) {
+        auto const next = compiled.code(&state, this);
+        if (next == exception_thrown) {
+          std::rethrow_exception(std::exchange(exception_, nullptr));
+        }
+        state.program_counter = static_cast<Address_t>(next);
+      }
+      else {
+        for (auto const& decoded : block->instructions) {
+          state.program_counter = decoded.handler(state, decoded.instruction);
+        }
+      }
+    }
+    catch (...) {
+      // The program counter is left on the instruction that threw, report the
+      // ones before it.
+      auto const retired = (state.program_counter - block->start) / 2u;
+      for (auto i = std::size_t{0}; i < retired; ++i) {
+        on_executed(block->instructions[i].instruction);
+      }
+      throw;
+    }
+    for (auto const& decoded : block->instructions) {
+      on_executed(decoded.instruction);
+    }
+    auto const [first, count] =
+      memory_write_range(state, block->instructions.back().instruction);
+    if (count != 0) {
+      // Last use of block, it may be destroyed here.
+      this->invalidate(first, count);
+    }
+    return true;
+  }
+
+  /// Discard every Block and compiled Block overlapping [first, first+count).
+  auto invalidate(Address_t first, std::size_t count) -> void
+  {
+    blocks_.invalidate(first, count);
+    auto const last   = std::min<std::size_t>(first + count, MEMORY_AMOUNT);
+    auto const window = Block_cache::max_block_length * 2 - 1;
+    auto const begin  = first > window ? first - window : std::size_t{0};
+    for (auto start = begin; start < last; ++start) {
+      if (compiled_[start].end > first) {
+        compiled_[start] = Compiled_block{};
+      }
+    }
+  }
+
+  /// Discard all Blocks and compiled code.
+  auto clear() -> void
+  {
+    blocks_.clear();
+    compiled_.fill(Compiled_block{});
+    code_.reset();
+  }
+
+ private:
+  using Native_fn_t = auto (*)(State*, Jit*) -> std::uint32_t;
+
+  struct Compiled_block {
+    Native_fn_t code = nullptr;
+    Address_t end    = 0;
+    int runs         = 0;
+  };
+
+  /// Returned by native code when a handler threw, the exception is stored in
+  /// exception_.
+  static constexpr auto exception_thrown = std::uint32_t{0xFFFFFFFF};
+
+  /// Host registers that cache V registers for the length of a block.
+  static constexpr auto cache_registers =
+    std::array{X86_emitter::rbx, X86_emitter::rbp, X86_emitter::r12,
+               X86_emitter::r13};
+
+ private:
+  /// Called from native code for instructions without a native translation.
+  static auto call_handler(State* state,
+                           Handler_t handler,
+                           Instruction_t instruction,
+                           Address_t program_counter,
+                           Jit* jit) noexcept -> std::uint32_t
+  {
+    try {
+      state->program_counter = program_counter;
+      return handler(*state, instruction);
+    }
+    catch (...) {
+      jit->exception_ = std::current_exception();
+      return exception_thrown;
+    }
+  }
+
+  auto compile(Block const& block) -> Native_fn_t
+  {
+    auto const code = Block_compiler{block}.compile();
+    auto* native    = code_.write(code);
+    if (native == nullptr) {
+      // Out of space, start over with an empty buffer.
+      compiled_.fill(Compiled_block{});
+      code_.reset();
+      native = code_.write(code);
+    }
+    return reinterpret_cast<Native_fn_t>(native);
+  }
+
+  /// Translates a single Block to machine code.
+  class Block_compiler {
+   public:
+    explicit Block_compiler(Block const& block) : block_{block}
+    {
+      this->allocate_registers();
+    }
+
+   public:
+    auto compile() -> std::vector<std::uint8_t>
+    {
+      this->prologue();
+      auto pc = block_.start;
+      for (auto const& decoded : block_.instructions) {
+        this->instruction(decoded, pc);
+        pc += 2;
+      }
+      if (!ends_block(block_.instructions.back().instruction)) {
+        // Block was cut short, fall through to the next one.
+        as_.mov_imm32(E::rax, block_.end);
+        this->exit();
+      }
+      return as_.bytes();
+    }
+
+   private:
+    using E       = X86_emitter;
+    using Operand = X86_emitter::Operand;
+    using Width   = X86_emitter::Width;
+
+    static auto v_offset(std::uint8_t v) -> std::size_t
+    {
+      return offsetof(State, general_purpose_registers) + v;
+    }
+
+    static constexpr auto i_offset = offsetof(State, index_register);
+
+    /// Return true if \p instruction is translated without calling a handler.
+    static auto is_native(Instruction_t instruction) -> bool
+    {
+      switch (opcode(instruction)) {
+        case 0x0: return instruction != 0x00E0 && instruction != 0x00EE;
+        case 0x1:
+        case 0x3:
+        case 0x4:
+        case 0x6:
+        case 0x7:
+        case 0xA: return true;
+        case 0x5:
+        case 0x9: return n(instruction) == 0;
+        case 0x8:
+          switch (n(instruction)) {
+            case 0x4:
+            case 0x5:
+            case 0x7: return x(instruction) != 0xF && y(instruction) != 0xF;
+            case 0x6:
+            case 0xE: return x(instruction) != 0xF;
+          }
+          return true;
+        case 0xF: return kk(instruction) == 0x1E;
+      }
+      return false;
+    }
+
+    /// Assign the most used V registers to host registers.
+    auto allocate_registers() -> void
+    {
+      auto uses = std::array<int, 16>{};
+      for (auto const& decoded : block_.instructions) {
+        auto const instruction = decoded.instruction;
+        if (!is_native(instruction)) {
+          continue;
+        }
+        ++uses[x(instruction)];
+        if (opcode(instruction) == 0x8 || opcode(instruction) == 0x5 ||
+            opcode(instruction) == 0x9) {
+          ++uses[y(instruction)];
+          ++uses[0xF];
+        }
+      }
+      auto order = std::array<std::uint8_t, 16>{};
+      for (auto i = 0; i < 16; ++i) {
+        order[i] = static_cast<std::uint8_t>(i);
+      }
+      std::ranges::stable_sort(
+        order, [&](auto a, auto b) { return uses[a] > uses[b]; });
+      for (auto i = std::size_t{0}; i < cache_registers.size(); ++i) {
+        if (uses[order[i]] > 1) {
+          cached_.push_back({order[i], cache_registers[i]});
+        }
+      }
+    }
+
+    /// Return the operand holding Vx, either a host register or State memory.
+    auto v(std::uint8_t vx) const -> Operand
+    {
+      for (auto const& [guest, host] : cached_) {
+        if (guest == vx) {
+          return E::reg(host);
+        }
+      }
+      return E::mem(v_offset(vx));
+    }
+
+    /// Load cached guest registers from State.
+    auto load_registers() -> void
+    {
+      for (auto const& [guest, host] : cached_) {
+        as_.op({0x8A}, host, E::mem(v_offset(guest)), Width::Byte);
+      }
+      as_.op({0x0F, 0xB7}, E::r14, E::mem(i_offset), Width::Dword);
+    }
+
+    /// Store cached guest registers back to State.
+    auto store_registers() -> void
+    {
+      for (auto const& [guest, host] : cached_) {
+        as_.op({0x88}, host, E::mem(v_offset(guest)), Width::Byte);
+      }
+      as_.op({0x89}, E::r14, E::mem(i_offset), Width::Word);
+    }
+
+    auto prologue() -> void
+    {
+      as_.emit({0x53, 0x55, 0x41, 0x54, 0x41, 0x55, 0x41, 0x56, 0x41, 0x57});
+      // Keep the Jit* argument at [rsp], this also aligns the stack for calls.
+      as_.emit({0x56});
+      as_.op({0x89}, E::rdi, E::reg(E::r15), Width::Qword);
+      this->load_registers();
+    }
+
+    /// Return eax without writing host registers back to State.
+    auto raw_exit() -> void
+    {
+      as_.emit({0x48, 0x83, 0xC4, 0x08,  // add rsp, 8
+                0x41, 0x5F, 0x41, 0x5E, 0x41, 0x5D, 0x41, 0x5C, 0x5D, 0x5B,
+                0xC3});
+    }
+
+    /// Write back registers and return eax as the next program counter.
+    auto exit() -> void
+    {
+      this->store_registers();
+      this->raw_exit();
+    }
+
+    /// Exit with eax = (condition ? pc + 4 : pc + 2), \p cmov is 0x44 (cmove)
+    /// or 0x45 (cmovne) and flags must already be set.
+    auto exit_skip(Address_t pc, std::uint8_t cmov) -> void
+    {
+      as_.mov_imm32(E::rax, pc + 2u);
+      as_.mov_imm32(E::rcx, pc + 4u);
+      as_.op({0x0F, cmov}, E::rax, E::reg(E::rcx), Width::Dword);
+      this->exit();
+    }
+
+    /// Call the instruction's handler through call_handler.
+    auto call(Decoded_instruction const& decoded, Address_t pc) -> void
+    {
+      this->store_registers();
+      as_.op({0x89}, E::r15, E::reg(E::rdi), Width::Qword);
+      as_.mov_imm64(E::rsi, reinterpret_cast<std::uint64_t>(decoded.handler));
+      as_.mov_imm32(E::rdx, decoded.instruction);
+      as_.mov_imm32(E::rcx, pc);
+      as_.emit({0x4C, 0x8B, 0x04, 0x24});  // mov r8, [rsp]
+      as_.mov_imm64(E::rax, reinterpret_cast<std::uint64_t>(&call_handler));
+      as_.emit({0xFF, 0xD0});  // call rax
+      if (ends_block(decoded.instruction)) {
+        // Handler returned the next program counter, State is up to date.
+        this->raw_exit();
+        return;
+      }
+      as_.emit({0x3D});  // cmp eax, exception_thrown
+      as_.emit32(exception_thrown);
+      auto const no_exception = as_.jump8(0x75);  // jne
+      this->raw_exit();
+      as_.patch8(no_exception);
+      this->load_registers();
+    }
+
+    /// al = Vx
+    auto load_al(std::uint8_t vx) -> void
+    {
+      as_.op({0x8A}, E::rax, this->v(vx), Width::Byte);
+    }
+
+    /// Vx = al
+    auto store_al(std::uint8_t vx) -> void
+    {
+      as_.op({0x88}, E::rax, this->v(vx), Width::Byte);
+    }
+
+    /// VF = cl
+    auto store_cl_to_vf() -> void
+    {
+      as_.op({0x88}, E::rcx, this->v(0xF), Width::Byte);
+    }
+
+    /// setcc cl
+    auto set_cl(std::uint8_t condition) -> void
+    {
+      as_.op({0x0F, condition}, 0, E::reg(E::rcx), Width::Byte);
+    }
+
+    auto instruction(Decoded_instruction const& decoded, Address_t pc) -> void
+    {
+      auto const instruction = decoded.instruction;
+      if (!is_native(instruction)) {
+        this->call(decoded, pc);
+        return;
+      }
+      auto const vx = x(instruction);
+      auto const vy = y(instruction);
+      switch (opcode(instruction)) {
+        case 0x0: break;  // System call, ignored.
+        case 0x1:
+          as_.mov_imm32(E::rax, nnn(instruction));
+          this->exit();
+          break;
+        case 0x3:
+        case 0x4:
+          as_.op({0x80}, 7, this->v(vx), Width::Byte);  // cmp Vx, kk
+          as_.emit({kk(instruction)});
+          this->exit_skip(pc, opcode(instruction) == 0x3 ? 0x44 : 0x45);
+          break;
+        case 0x5:
+        case 0x9:
+          this->load_al(vx);
+          as_.op({0x3A}, E::rax, this->v(vy), Width::Byte);  // cmp al, Vy
+          this->exit_skip(pc, opcode(instruction) == 0x5 ? 0x44 : 0x45);
+          break;
+        case 0x6:
+          as_.op({0xC6}, 0, this->v(vx), Width::Byte);  // mov Vx, kk
+          as_.emit({kk(instruction)});
+          break;
+        case 0x7:
+          as_.op({0x80}, 0, this->v(vx), Width::Byte);  // add Vx, kk
+          as_.emit({kk(instruction)});
+          break;
+        case 0x8: this->alu(instruction); break;
+        case 0xA: as_.mov_imm32(E::r14, nnn(instruction)); break;
+        case 0xF:  // Fx1E
+          this->load_al(vx);
+          as_.op({0x0F, 0xB6}, E::rax, E::reg(E::rax), Width::Dword);
+          as_.op({0x03}, E::r14, E::reg(E::rax), Width::Dword);
+          as_.op({0x0F, 0xB7}, E::r14, E::reg(E::r14), Width::Dword);
+          break;
+      }
+    }
+
+    /// 8xyN, VF is never an operand of the instructions that write it.
+    auto alu(Instruction_t instruction) -> void
+    {
+      auto const vx = x(instruction);
+      auto const vy = y(instruction);
+      switch (n(instruction)) {
+        case 0x0:
+          this->load_al(vy);
+          this->store_al(vx);
+          break;
+        case 0x1:
+        case 0x2:
+        case 0x3: {
+          auto const op = std::array<std::uint8_t, 4>{0, 0x0A, 0x22, 0x32};
+          this->load_al(vx);
+          as_.op({op[n(instruction)]}, E::rax, this->v(vy), Width::Byte);
+          this->store_al(vx);
+          break;
+        }
+        case 0x4:
+          this->load_al(vx);
+          as_.op({0x02}, E::rax, this->v(vy), Width::Byte);  // add al, Vy
+          this->set_cl(0x92);                                 // setc
+          this->store_al(vx);
+          this->store_cl_to_vf();
+          break;
+        case 0x5:
+        case 0x7: {
+          auto const [lhs, rhs] =
+            n(instruction) == 0x5 ? std::pair{vx, vy} : std::pair{vy, vx};
+          this->load_al(lhs);
+          as_.op({0x2A}, E::rax, this->v(rhs), Width::Byte);  // sub al, rhs
+          this->set_cl(0x97);                                  // seta
+          this->store_al(vx);
+          this->store_cl_to_vf();
+          break;
+        }
+        case 0x6:
+        case 0xE:
+          this->load_al(vx);
+          // shr al, 1 / shl al, 1
+          as_.op({0xD0}, n(instruction) == 0x6 ? 5 : 4, E::reg(E::rax),
+                 Width::Byte);
+          this->set_cl(0x92);  // setc
+          this->store_al(vx);
+          this->store_cl_to_vf();
+          break;
+        default: break;  // Unused encodings do nothing.
+      }
+    }
+
+   private:
+    Block const& block_;
+    X86_emitter as_;
+    std::vector<std::pair<std::uint8_t, X86_emitter::Reg>> cached_;
+  };
+
+ private:
+  Block_cache blocks_;
+  std::array<Compiled_block, MEMORY_AMOUNT> compiled_{};
+  Code_buffer code_;
+  std::exception_ptr exception_;
+};
+
+}  // namespace chip8
+#endif  // CHIP8_JIT
+#endif  // JIT_HPP
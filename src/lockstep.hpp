@@ -0,0 +1,466 @@
+#ifndef LOCKSTEP_HPP
+#define LOCKSTEP_HPP
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "constants.hpp"
+#include "headless.hpp"
+#include "initialize.hpp"
+#include "instructions.hpp"
+#include "keyboard.hpp"
+#include "random.hpp"
+#include "state.hpp"
+#include "types.hpp"
+
+namespace chip8 {
+
+/// Runs Lanes headless copies of one program side by side, a lane per machine.
+/** V registers, I, the program counter and the timers are stored as structure
+ *  of arrays, one array per field holding every lane. Each step executes the
+ *  instruction at the lowest program counter of the running lanes, for every
+ *  lane at that address. Register, index, timer, skip and jump instructions
+ *  update all of those lanes in one pass over the arrays, written so the
+ *  compiler vectorizes it (AVX2 with CHIP8_NATIVE on a capable host). Other
+ *  instructions, and lanes whose control flow has diverged from most of the
+ *  others, run one lane at a time through process_instruction.
+ *
+ *  Each lane ends in the same State that resume_headless() leaves a lone
+ *  machine in, except that a lane throwing an exception halts with the
+ *  message as its halt reason. */
+template <std::size_t Lanes>
+class Lockstep_batch {
+ public:
+  static_assert(Lanes > 0);
+
+  template <typename T>
+  using Lane_array = std::array<T, Lanes>;
+
+  /// A step executed by fewer than Lanes/scalar_divisor lanes runs them one at
+  /// a time, a full pass over the arrays is not worth it.
+  static constexpr auto scalar_divisor = std::size_t{8};
+
+ public:
+  /// Load \p program into every lane.
+  /** With a \p seed, lane i draws its random numbers from seed + i, as a lone
+   *  machine initialized with that seed and job i of a run_batch() with that
+   *  Batch_options::seed do. Without one every lane draws the same numbers,
+   *  from Random_generator::default_seed. */
+  explicit Lockstep_batch(std::vector<char> const& program,
+                          std::optional<std::uint64_t> seed = std::nullopt)
+  {
+    auto initial = initialize_state(program);
+    initial.keyboard.detach();
+    original_memory_ = initial.memory;
+    machines_.assign(Lanes, initial);
+    for (auto lane = std::size_t{0}; lane < Lanes; ++lane) {
+      machines_[lane].random_generator =
+        seed ? Random_generator{*seed + lane} : Random_generator{};
+      this->store_lane(lane, initial);
+    }
+  }
+
+ public:
+  /// Run every lane until it has executed at least \p cycle_limit
+  /// instructions in total or has halted, see resume_headless().
+  auto run(std::uint64_t cycle_limit, std::uint64_t cycles_per_frame) -> void
+  {
+    for (auto lane = std::size_t{0}; lane < Lanes; ++lane) {
+      auto const count = this->instructions(lane);
+      running_[lane]   = halt_reasons_[lane].empty() && count < cycle_limit;
+      next_frame_[lane] = (frames_[lane] + 1) * cycles_per_frame;
+      this->schedule(lane, count, cycle_limit);
+    }
+    while (true) {
+      auto leader = std::uint16_t{0xFFFF};
+      for (auto lane = std::size_t{0}; lane < Lanes; ++lane) {
+        // 0xFFFF for lanes that are not running.
+        auto const address =
+          std::uint16_t(pc_[lane] | std::uint16_t(running_[lane] - 1u));
+        leader = std::min(leader, address);
+      }
+      if (leader == 0xFFFF) {
+        return;
+      }
+      auto active = std::uint32_t{0};
+      for (auto lane = std::size_t{0}; lane < Lanes; ++lane) {
+        mask_[lane] = running_[lane] & (pc_[lane] == leader);
+        active += mask_[lane];
+      }
+      if (leader + 1u >= MEMORY_AMOUNT) {
+        this->halt_masked("invalid program counter");
+        continue;
+      }
+      auto const instruction = this->select_instruction(leader, active);
+      if (active * scalar_divisor < Lanes || !this->step_vector(instruction)) {
+        this->step_scalar(instruction);
+      }
+      this->retire(cycle_limit, cycles_per_frame);
+    }
+  }
+
+  /// Return the State of the machine in \p lane.
+  auto state(std::size_t lane) const -> State
+  {
+    auto result = machines_[lane];
+    this->load_lane(lane, result);
+    return result;
+  }
+
+  /// Replace the State of the machine in \p lane, its keyboard is detached.
+  auto set_state(std::size_t lane, State const& state) -> void
+  {
+    machines_[lane] = state;
+    machines_[lane].keyboard.detach();
+    this->store_lane(lane, state);
+    for (auto address = std::size_t{0}; address < MEMORY_AMOUNT; ++address) {
+      if (state.memory[address] != original_memory_[address]) {
+        written_[address] = true;
+      }
+    }
+  }
+
+  /// Instruction count, frame count and halt reason of \p lane. Elapsed time
+  /// is not tracked per lane.
+  auto report(std::size_t lane) const -> Headless_report
+  {
+    return {this->instructions(lane), frames_[lane], {}, halt_reasons_[lane]};
+  }
+
+ private:
+  /// Return the instruction at \p address for the masked lanes. If any lane
+  /// may have modified the code there, lanes holding a different instruction
+  /// are removed from the mask and from \p active; they run on a later step.
+  auto select_instruction(Address_t address, std::uint32_t& active)
+    -> Instruction_t
+  {
+    auto const word = [address](auto const& memory) {
+      return Instruction_t((memory[address] << 8) | memory[address + 1]);
+    };
+    if (!written_[address] && !written_[address + 1]) {
+      return word(original_memory_);
+    }
+    auto const first =
+      std::size_t(std::ranges::find(mask_, 1) - std::begin(mask_));
+    auto const instruction = word(machines_[first].memory);
+    for (auto lane = first + 1; lane < Lanes; ++lane) {
+      if (mask_[lane] && word(machines_[lane].memory) != instruction) {
+        mask_[lane] = 0;
+        --active;
+      }
+    }
+    return instruction;
+  }
+
+  /// Execute \p instruction on every masked lane at once. Returns false
+  /// without doing anything if it has no vector implementation.
+  auto step_vector(Instruction_t instruction) -> bool
+  {
+    auto& vx       = registers_[x(instruction)];
+    auto& vy       = registers_[y(instruction)];
+    auto& vf       = registers_[0xF];
+    auto& i        = index_;
+    auto& delay    = delay_;
+    auto& sound    = sound_;
+    auto const kk_ = kk(instruction);
+    auto const nnn_   = nnn(instruction);
+    switch (opcode(instruction)) {
+      case 0x0:
+        if (instruction == 0x00E0 || instruction == 0x00EE) {
+          return false;
+        }
+        break;
+      case 0x1: this->jump([&](std::size_t) { return nnn_; }); return true;
+      case 0x3:
+        this->skip_if([&](std::size_t l) { return vx[l] == kk_; });
+        return true;
+      case 0x4:
+        this->skip_if([&](std::size_t l) { return vx[l] != kk_; });
+        return true;
+      case 0x5:
+        if (n(instruction) != 0) {
+          return false;
+        }
+        this->skip_if([&](std::size_t l) { return vx[l] == vy[l]; });
+        return true;
+      case 0x6: this->update(vx, [&](std::size_t) { return kk_; }); break;
+      case 0x7:
+        this->update(vx, [&](std::size_t l) { return vx[l] + kk_; });
+        break;
+      case 0x8:
+        // VF is written first, as in instructions.hpp, so the result reads it
+        // back when x or y is F.
+        switch (n(instruction)) {
+          case 0x0:
+            this->update(vx, [&](std::size_t l) { return vy[l]; });
+            break;
+          case 0x1:
+            this->update(vx, [&](std::size_t l) { return vx[l] | vy[l]; });
+            break;
+          case 0x2:
+            this->update(vx, [&](std::size_t l) { return vx[l] & vy[l]; });
+            break;
+          case 0x3:
+            this->update(vx, [&](std::size_t l) { return vx[l] ^ vy[l]; });
+            break;
+          case 0x4:
+            this->update(vf, [&](std::size_t l) {
+              return std::uint8_t(vx[l] + vy[l]) < vx[l];
+            });
+            this->update(vx, [&](std::size_t l) { return vx[l] + vy[l]; });
+            break;
+          case 0x5:
+            this->update(vf, [&](std::size_t l) { return vx[l] > vy[l]; });
+            this->update(vx, [&](std::size_t l) { return vx[l] - vy[l]; });
+            break;
+          case 0x6:
+            this->update(vf, [&](std::size_t l) { return vx[l] & 1; });
+            this->update(vx, [&](std::size_t l) { return vx[l] >> 1; });
+            break;
+          case 0x7:
+            this->update(vf, [&](std::size_t l) { return vy[l] > vx[l]; });
+            this->update(vx, [&](std::size_t l) { return vy[l] - vx[l]; });
+            break;
+          case 0xE:
+            this->update(vf, [&](std::size_t l) { return vx[l] >> 7; });
+            this->update(vx, [&](std::size_t l) { return vx[l] << 1; });
+            break;
+        }
+        break;
+      case 0x9:
+        if (n(instruction) != 0) {
+          return false;
+        }
+        this->skip_if([&](std::size_t l) { return vx[l] != vy[l]; });
+        return true;
+      case 0xA: this->update(i, [&](std::size_t) { return nnn_; }); break;
+      case 0xB: {
+        auto const& v0 = registers_[0x0];
+        this->jump([&](std::size_t l) { return nnn_ + v0[l]; });
+        return true;
+      }
+      case 0xF:
+        switch (kk_) {
+          case 0x07:
+            this->update(vx, [&](std::size_t l) { return delay[l]; });
+            break;
+          case 0x15:
+            this->update(delay, [&](std::size_t l) { return vx[l]; });
+            break;
+          case 0x18:
+            this->update(sound, [&](std::size_t l) { return vx[l]; });
+            break;
+          case 0x1E:
+            this->update(i, [&](std::size_t l) { return i[l] + vx[l]; });
+            break;
+          case 0x29:
+            this->update(i, [&](std::size_t l) {
+              return i[l] + vx[l] * 5u + DIGIT_SPRITE_OFFSET;
+            });
+            break;
+          default: return false;
+        }
+        break;
+      default: return false;
+    }
+    this->jump([this](std::size_t l) { return pc_[l] + 2u; });
+    return true;
+  }
+
+  /// Execute \p instruction on each masked lane through process_instruction.
+  auto step_scalar(Instruction_t instruction) -> void
+  {
+    for (auto lane = std::size_t{0}; lane < Lanes; ++lane) {
+      if (!mask_[lane]) {
+        continue;
+      }
+      auto& state = machines_[lane];
+      this->load_lane(lane, state);
+      try {
+        state.program_counter = process_instruction(state, instruction);
+      }
+      catch (Detached_keyboard_error const&) {
+        this->halt(lane, "waiting for a keypress");
+        continue;
+      }
+      catch (std::exception const& e) {
+        this->halt(lane, e.what());
+        continue;
+      }
+      this->store_lane(lane, state);
+      auto const [first, count] = memory_write_range(state, instruction);
+      auto const last = std::min<std::size_t>(first + count, MEMORY_AMOUNT);
+      for (auto address = std::size_t{first}; address < last; ++address) {
+        written_[address] = true;
+      }
+    }
+  }
+
+  /// Count the step for every masked lane. Frame ticks and the cycle limit
+  /// are handled by handle_events() once a lane's countdown reaches zero.
+  auto retire(std::uint64_t cycle_limit, std::uint64_t cycles_per_frame)
+    -> void
+  {
+    auto event = std::uint8_t{0};
+    for (auto lane = std::size_t{0}; lane < Lanes; ++lane) {
+      countdown_[lane] -= mask_[lane];
+      event |= mask_[lane] & (countdown_[lane] == 0);
+    }
+    if (event != 0) {
+      this->handle_events(cycle_limit, cycles_per_frame);
+    }
+  }
+
+  /// Tick the timers of masked lanes that reached a frame boundary, stop the
+  /// ones that reached \p cycle_limit and schedule the next event of each.
+  auto handle_events(std::uint64_t cycle_limit,
+                     std::uint64_t cycles_per_frame) -> void
+  {
+    // Branch free so it vectorizes, in lockstep every lane hits its events on
+    // the same step.
+    for (auto lane = std::size_t{0}; lane < Lanes; ++lane) {
+      auto const hit  = (mask_[lane] != 0) & (countdown_[lane] == 0);
+      auto const tick = hit & (event_at_[lane] >= next_frame_[lane]);
+      delay_[lane] -= tick & (delay_[lane] != 0);
+      sound_[lane] -= tick & (sound_[lane] != 0);
+      running_[lane] &= !(hit & (event_at_[lane] >= cycle_limit));
+    }
+    for (auto lane = std::size_t{0}; lane < Lanes; ++lane) {
+      auto const hit   = std::uint64_t(mask_[lane] != 0) &
+                       std::uint64_t(countdown_[lane] == 0);
+      auto const count = event_at_[lane];
+      auto const tick  = hit & std::uint64_t(count >= next_frame_[lane]);
+      frames_[lane] += tick;
+      next_frame_[lane] += tick * cycles_per_frame;
+      auto const next = this->next_event(lane, count, cycle_limit);
+      event_at_[lane]  = hit ? next : count;
+      countdown_[lane] = hit ? std::uint32_t(next - count) : countdown_[lane];
+    }
+  }
+
+  /// Return the instruction count of the next frame boundary of \p lane, or
+  /// \p cycle_limit if that comes first. \p count is the current count.
+  auto next_event(std::size_t lane,
+                  std::uint64_t count,
+                  std::uint64_t cycle_limit) const -> std::uint64_t
+  {
+    // Bounded so the distance fits in countdown_.
+    auto const furthest = count + std::uint64_t{0xFFFF'FFFF};
+    return std::max(
+      std::min(std::min(next_frame_[lane], cycle_limit), furthest), count);
+  }
+
+  /// Set the countdown of \p lane, which has executed \p count instructions,
+  /// to its next event.
+  auto schedule(std::size_t lane,
+                std::uint64_t count,
+                std::uint64_t cycle_limit) -> void
+  {
+    event_at_[lane]  = this->next_event(lane, count, cycle_limit);
+    countdown_[lane] = std::uint32_t(event_at_[lane] - count);
+  }
+
+  /// Return the number of instructions \p lane has executed.
+  auto instructions(std::size_t lane) const -> std::uint64_t
+  {
+    return event_at_[lane] - countdown_[lane];
+  }
+
+  /// Set each masked element of \p field to value(lane).
+  template <typename T, typename Fn>
+  auto update(Lane_array<T>& field, Fn&& value) -> void
+  {
+    for (auto lane = std::size_t{0}; lane < Lanes; ++lane) {
+      // Bitwise select, a conditional is only vectorized with SSE4.1 blends.
+      auto const select = T(-T(mask_[lane]));
+      field[lane] = T((T(value(lane)) & select) | (field[lane] & ~select));
+    }
+  }
+
+  /// Set the program counter of each masked lane to target(lane).
+  template <typename Fn>
+  auto jump(Fn&& target) -> void
+  {
+    this->update(pc_, target);
+  }
+
+  /// Advance each masked lane past the next instruction if condition(lane).
+  template <typename Fn>
+  auto skip_if(Fn&& condition) -> void
+  {
+    this->jump(
+      [&](std::size_t l) { return pc_[l] + (condition(l) ? 4u : 2u); });
+  }
+
+  auto halt(std::size_t lane, std::string reason) -> void
+  {
+    halt_reasons_[lane] = std::move(reason);
+    running_[lane]      = 0;
+    mask_[lane]         = 0;
+  }
+
+  auto halt_masked(std::string const& reason) -> void
+  {
+    for (auto lane = std::size_t{0}; lane < Lanes; ++lane) {
+      if (mask_[lane]) {
+        this->halt(lane, reason);
+      }
+    }
+  }
+
+  /// Copy the arrays of \p lane into \p state.
+  auto load_lane(std::size_t lane, State& state) const -> void
+  {
+    for (auto r = std::size_t{0}; r < registers_.size(); ++r) {
+      state.general_purpose_registers[r] = registers_[r][lane];
+    }
+    state.index_register             = index_[lane];
+    state.program_counter            = pc_[lane];
+    state.delay_timer_register.value = delay_[lane];
+    state.sound_timer_register.value = sound_[lane];
+  }
+
+  /// Copy \p state into the arrays of \p lane.
+  auto store_lane(std::size_t lane, State const& state) -> void
+  {
+    for (auto r = std::size_t{0}; r < registers_.size(); ++r) {
+      registers_[r][lane] = state.general_purpose_registers[r];
+    }
+    index_[lane] = state.index_register;
+    pc_[lane]    = state.program_counter;
+    delay_[lane] = state.delay_timer_register.value;
+    sound_[lane] = state.sound_timer_register.value;
+  }
+
+ private:
+  // Memory, screen, stack and keyboard of each lane. The other fields are
+  // only up to date while a lane is executing through process_instruction.
+  std::vector<State> machines_;
+  std::array<std::uint8_t, MEMORY_AMOUNT> original_memory_{};
+  std::array<bool, MEMORY_AMOUNT> written_{};  // By any lane, since loading.
+
+  // Fixed size member arrays let the compiler see that the fields don't
+  // overlap, which keeps runtime alias checks out of the vectorized loops.
+  std::array<Lane_array<std::uint8_t>, 16> registers_{};
+  Lane_array<std::uint16_t> index_{};
+  Lane_array<std::uint16_t> pc_{};
+  Lane_array<std::uint8_t> delay_{};
+  Lane_array<std::uint8_t> sound_{};
+
+  Lane_array<std::uint8_t> running_{};  // Not halted and below the limit.
+  Lane_array<std::uint8_t> mask_{};     // Lanes executing the current step.
+  // A lane has executed event_at_ - countdown_ instructions, see retire().
+  Lane_array<std::uint32_t> countdown_{};
+  Lane_array<std::uint64_t> event_at_{};
+  Lane_array<std::uint64_t> frames_{};
+  Lane_array<std::uint64_t> next_frame_{};
+  Lane_array<std::string> halt_reasons_{};
+};
+
+}  // namespace chip8
+#endif  // LOCKSTEP_HPP
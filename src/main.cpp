@@ -1,24 +1,45 @@
 #include <algorithm>
+#include <chrono>
 #include <cmath>
+#include <cstddef>
 #include <cstdint>
 #include <fstream>
 #include <iostream>
 #include <iterator>
 #include <optional>
+#include <ostream>
 #include <stdexcept>
 #include <string>
-#include <thread>
+#include <utility>
 #include <vector>
 
+#include <unistd.h>
+
 #include <esc/terminal.hpp>
 
+#include "backend.hpp"
+#include "batch.hpp"
+#include "block_cache.hpp"
 #include "clock.hpp"
 #include "constants.hpp"
 #include "debug.hpp"
+#include "decode_cache.hpp"
+#include "headless.hpp"
+#include "idle.hpp"
 #include "initialize.hpp"
+#include "input_thread.hpp"
 #include "instructions.hpp"
+#include "jit.hpp"
 #include "keyboard.hpp"
+#include "movie.hpp"
+#include "present.hpp"
+#include "random.hpp"
+#include "render_thread.hpp"
+#include "rewind.hpp"
+#include "save_state.hpp"
+#include "scheduler.hpp"
 #include "screen.hpp"
+#include "threaded.hpp"
 #include "timer.hpp"
 
 #define DEBUG 0
@@ -26,20 +47,139 @@
 struct Options {
   std::string rom_filepath;
   std::optional<std::uint16_t> clock_hz;
+  chip8::Backend backend = chip8::Backend::Decode_cache;
+  bool headless          = false;
+  std::optional<std::uint64_t> cycles;
+  std::optional<std::uint64_t> frames;
+  std::optional<std::string> batch_filepath;
+  std::optional<std::string> summary_filepath;
+  std::uint64_t slice_cycles = 10'000;
+  std::optional<std::uint64_t> threads;
+  chip8::Present_mode present_mode = chip8::Present_mode::Frame;
+  chip8::Render_mode render_mode   = chip8::Render_mode::Half_block;
+  std::uint64_t sixel_scale        = chip8::Renderer::default_sixel_scale;
+  chip8::Timer_mode timer_mode     = chip8::Timer_mode::Cycle;
+  std::optional<std::uint64_t> seed;
+  std::optional<std::string> load_state_filepath;
+  std::optional<std::string> save_state_filepath;
+  std::optional<std::string> record_filepath;
+  std::optional<std::string> replay_filepath;
+  bool rewind = false;
 };
 
+/// Return true if the flag \p name is present in \p args.
+auto has_flag(std::vector<std::string> const& args, std::string const& name)
+  -> bool
+{
+  return std::ranges::find(args, name) != std::end(args);
+}
+
+/// Parse the argument of \p name as a positive count.
+auto parse_count(std::string const& name, std::string const& arg)
+  -> std::uint64_t
+{
+  try {
+    auto pos         = std::size_t{0};
+    auto const count = std::stoull(arg, &pos);
+    if (pos != arg.size() || count == 0 || arg.starts_with('-')) {
+      throw std::invalid_argument{arg};
+    }
+    return count;
+  }
+  catch (std::logic_error const&) {
+    throw std::runtime_error{name + " argument must be a positive integer."};
+  }
+}
+
+/// Parse the argument of \p name as a seed, any 64 bit unsigned integer.
+auto parse_seed(std::string const& name, std::string const& arg)
+  -> std::uint64_t
+{
+  try {
+    auto pos        = std::size_t{0};
+    auto const seed = std::stoull(arg, &pos);
+    if (pos != arg.size() || arg.starts_with('-')) {
+      throw std::invalid_argument{arg};
+    }
+    return seed;
+  }
+  catch (std::logic_error const&) {
+    throw std::runtime_error{name + " argument must be an unsigned integer."};
+  }
+}
+
+/// Return the value given for \p name as `name value` or `name=value`.
+auto find_option(std::vector<std::string> const& args, std::string const& name)
+  -> std::optional<std::string>
+{
+  for (auto at = std::begin(args); at != std::end(args); ++at) {
+    if (*at == name) {
+      if (std::next(at) == std::end(args)) {
+        throw std::runtime_error{name + " is missing its argument."};
+      }
+      return *std::next(at);
+    }
+    if (at->starts_with(name + "=")) {
+      return at->substr(name.size() + 1);
+    }
+  }
+  return std::nullopt;
+}
+
 /// Usage: chip8 <rom> [--clock uint16_t]
+///                    [--backend interpreter|cache|block|jit|threaded]
+///                    [--renderer halfblock|braille|sextant|sixel]
+///                    [--scale N]
+///                    [--present frame|immediate] [--timers cycle|wallclock]
+///                    [--seed N] [--load-state file] [--save-state file]
+///                    [--record file] [--rewind]
+///                    [--headless --cycles N|--frames N]
+///        chip8 <rom> --replay <movie> [--backend ...] [--save-state file]
+///        chip8 --batch <rom list> --cycles N|--frames N [--slice N]
+///                    [--threads N] [--summary file] [--seed N]
+///                    [--clock uint16_t]
+///                    [--backend interpreter|cache|block|jit|threaded]
 auto parse_command_line(int argc, char* argv[]) -> Options
 {
   if (argc < 2) {
-    throw std::runtime_error{"Usage: chip8 <rom> [--clock uint16_t]"};
+    throw std::runtime_error{
+      "Usage: chip8 <rom> [--clock uint16_t] "
+      "[--backend interpreter|cache|block|jit|threaded] "
+      "[--renderer halfblock|braille|sextant|sixel] [--scale N] "
+      "[--present frame|immediate] [--timers cycle|wallclock] [--seed N] "
+      "[--load-state file] [--save-state file] [--record file] [--rewind] "
+      "[--headless --cycles N|--frames N]\n"
+      "       chip8 <rom> --replay <movie> [--backend ...] "
+      "[--save-state file]\n"
+      "       chip8 --batch <rom list> --cycles N|--frames N [--slice N] "
+      "[--threads N] [--summary file] [--seed N]"};
   }
-  auto const args = std::vector(argv, std::next(argv, argc));
-  auto result     = Options{args[1], std::nullopt};
-  auto const at   = std::ranges::find(args, std::string{"--clock"});
-  if (at != std::end(args) && std::next(at) != std::end(args)) {
+  auto const args = std::vector<std::string>(argv, std::next(argv, argc));
+  auto result           = Options{};
+  result.rom_filepath   = args[1];
+  result.batch_filepath = find_option(args, "--batch");
+  if (result.batch_filepath) {
+    result.rom_filepath.clear();
+    result.headless         = true;
+    result.summary_filepath = find_option(args, "--summary");
+    if (auto const slice_arg = find_option(args, "--slice")) {
+      result.slice_cycles = parse_count("--slice", *slice_arg);
+    }
+    if (auto const threads_arg = find_option(args, "--threads")) {
+      result.threads = parse_count("--threads", *threads_arg);
+    }
+  }
+  result.load_state_filepath = find_option(args, "--load-state");
+  result.save_state_filepath = find_option(args, "--save-state");
+  if (result.batch_filepath &&
+      (result.load_state_filepath || result.save_state_filepath)) {
+    throw std::runtime_error{
+      "--load-state and --save-state cannot be used with --batch, give the "
+      "save states of each machine in the batch file."};
+  }
+  if (auto const clock_arg = find_option(args, "--clock")) {
     try {
-      auto const clock = std::stoi(*std::next(at));
+      auto const clock = std::stoi(*clock_arg);
       if (clock >= std::pow(2, 16) || clock < 0) {
         throw std::runtime_error{"--clock argument must fit in a uint16_t."};
       }
@@ -52,59 +192,426 @@ auto parse_command_line(int argc, char* argv[]) -> Options
       throw std::runtime_error{"--clock argument must fit in a uint16_t."};
     }
   }
-  else if (at != std::end(args) && std::next(at) == std::end(args)) {
-    throw std::runtime_error{"--clock is missing its integer argument."};
+  if (auto const backend_arg = find_option(args, "--backend")) {
+    result.backend = chip8::parse_backend(*backend_arg);
+  }
+  if (auto const renderer_arg = find_option(args, "--renderer")) {
+    result.render_mode = chip8::parse_render_mode(*renderer_arg);
+  }
+  if (auto const scale_arg = find_option(args, "--scale")) {
+    result.sixel_scale = parse_count("--scale", *scale_arg);
+  }
+  if (auto const seed_arg = find_option(args, "--seed")) {
+    result.seed = parse_seed("--seed", *seed_arg);
+  }
+  if (auto const timers_arg = find_option(args, "--timers")) {
+    result.timer_mode = chip8::parse_timer_mode(*timers_arg);
+  }
+  if (auto const present_arg = find_option(args, "--present")) {
+    result.present_mode = chip8::parse_present_mode(*present_arg);
+  }
+  result.record_filepath = find_option(args, "--record");
+  result.replay_filepath = find_option(args, "--replay");
+  if ((result.record_filepath || result.replay_filepath) &&
+      (result.batch_filepath || result.load_state_filepath)) {
+    throw std::runtime_error{
+      "--record and --replay cannot be used with --batch or --load-state."};
+  }
+  if (result.record_filepath &&
+      (result.replay_filepath || has_flag(args, "--headless") ||
+       result.timer_mode == chip8::Timer_mode::Wall_clock)) {
+    throw std::runtime_error{
+      "--record requires an interactive run with --timers cycle."};
+  }
+  result.rewind = has_flag(args, "--rewind");
+  if (result.rewind &&
+      (result.batch_filepath || result.replay_filepath ||
+       result.record_filepath || has_flag(args, "--headless"))) {
+    throw std::runtime_error{
+      "--rewind requires an interactive run without --record."};
+  }
+  if (result.replay_filepath) {
+    if (result.seed || find_option(args, "--cycles") ||
+        find_option(args, "--frames")) {
+      throw std::runtime_error{
+        "--replay takes its seed and length from the movie."};
+    }
+    result.headless = true;
+    return result;
+  }
+  result.headless = result.headless || has_flag(args, "--headless");
+  if (auto const cycles_arg = find_option(args, "--cycles")) {
+    result.cycles = parse_count("--cycles", *cycles_arg);
+  }
+  if (auto const frames_arg = find_option(args, "--frames")) {
+    result.frames = parse_count("--frames", *frames_arg);
+  }
+  if (result.headless &&
+      result.cycles.has_value() == result.frames.has_value()) {
+    throw std::runtime_error{
+      "--headless and --batch require one of --cycles or --frames."};
+  }
+  if (!result.headless && (result.cycles || result.frames)) {
+    throw std::runtime_error{"--cycles and --frames require --headless."};
   }
   return result;
 }
 
-auto main(int argc, char* argv[]) -> int
+/// Run \p state on \p backend until the program counter becomes invalid.
+/** Instructions run in 60Hz frames, see Cycle_scheduler. The rest of a frame
+ *  spent in an idle loop or waiting for a key is slept through, and the
+ *  skipped iterations are not counted in the returned stats. Each frame is
+ *  recorded to \p recorder and captured in \p rewind unless they are null.
+ *  At the end of a frame, the rewind key steps back one captured frame per
+ *  press and the save state key writes options.save_state_filepath, if given.
+ *  Returns the speed achieved. */
+template <typename Backend_t>
+auto run(chip8::State& state,
+         Backend_t& backend,
+         chip8::Instruction_clock const& clock,
+         chip8::Render_thread& renderer,
+         Options const& options,
+         chip8::Input_thread& input,
+         chip8::Movie_recorder* recorder,
+         chip8::Rewind_buffer* rewind) -> chip8::Pacing_stats
 {
   using namespace chip8;
-  try {
-    {
-      using namespace esc;
-      initialize_interactive_terminal(Mouse_mode::Off, Key_mode::Normal);
-    }
-
-    auto const options = parse_command_line(argc, argv);
-    auto state         = initialize_state(load_program(argv[1]));
 #if DEBUG
-    auto debug_file     = std::ofstream{"debug.txt"};
-    auto const clock_fn = make_clock_fn(4);
-#else
-    auto const clock_fn =
-      make_clock_fn(options.clock_hz ? options.clock_hz : 500);
+  auto debug_file = std::ofstream{"debug.txt"};
 #endif
-    while (true) {
+  auto pacing     = Cycle_scheduler{};
+  auto presenting = Present_scheduler{options.present_mode};
+  auto idle       = Idle_detector{};
+  while (true) {
+    pacing.begin_frame();
+    if (recorder != nullptr) {
+      recorder->begin_frame();
+    }
+    while (pacing.in_budget()) {
 #if DEBUG
       write_state(debug_file, state);
 #endif
-      auto const start       = Clock_t::now();
-      auto const instruction = get_instruction(state);
-      if (!instruction.has_value()) {
-        break;
+      auto graphics = false;
+      auto const running =
+        backend.run(state, [&](Instruction_t instruction) {
+          if (clock.waits_for_vblank(instruction)) {
+            pacing.wait_for_vblank();
+          }
+          pacing.spend(clock(instruction, state.sprite_x));
+          idle.on_executed(instruction);
+          if (recorder != nullptr) {
+            recorder->on_executed();
+          }
+          graphics = graphics || is_graphics_instruction(instruction);
+        });
+      if (!running) {
+        if (recorder != nullptr) {
+          recorder->end_frame(state, true);
+        }
+        return pacing.stats();
+      }
+      if (state.waiting_for_key || idle.check(state)) {
+        // Sleep out the frame, timers and the display carry on. Fx0A or the
+        // idle loop polls the keys and timers again next frame.
+        pacing.wait_for_vblank();
       }
-      state.program_counter          = process_instruction(state, *instruction);
-      auto const instruction_runtime = clock_fn(*instruction);
 
-      update_timer(state.delay_timer_register);
-      update_timer(state.sound_timer_register);
+      if (options.timer_mode == Timer_mode::Wall_clock) {
+        update_timer(state.delay_timer_register);
+        update_timer(state.sound_timer_register);
+      }
 
-      if (is_graphics_instruction(*instruction)) {
-        update_graphics(state);
+      if (graphics && presenting.on_draw()) {
+        renderer.publish(state.screen_buffer);
       }
+    }
+    if (options.timer_mode == Timer_mode::Cycle) {
+      tick_timer(state.delay_timer_register);
+      tick_timer(state.sound_timer_register);
+    }
+    if (recorder != nullptr) {
+      recorder->end_frame(state);
+    }
+    if (rewind != nullptr) {
+      if (auto const presses = input.take_presses(Host_key::Rewind)) {
+        rewind->rewind(presses, state);
+        backend.clear();  // The restored memory may hold other code.
+        if (presenting.on_draw()) {
+          renderer.publish(state.screen_buffer);
+        }
+      }
+      else {
+        rewind->capture(state);
+      }
+    }
+    if (input.take_presses(Host_key::Save_state) > 0 &&
+        options.save_state_filepath) {
+      save_state(state, *options.save_state_filepath);
+    }
+    if (presenting.on_tick()) {
+      renderer.publish(state.screen_buffer);
+    }
+  }
+}
+
+/// Write the achieved against the target speed of an interactive run.
+/** Frames slept through in an idle loop or waiting for a key add no
+ *  instructions, so both rates fall below the clock of a program that idles,
+ *  unlike the instruction counts of headless runs. */
+auto write_pacing_stats(std::ostream& os, chip8::Pacing_stats const& stats)
+  -> void
+{
+  using seconds = std::chrono::duration<double>;
 
-      // Wait out for rest of instruction cycle time.
-      auto const elapsed = Clock_t::now() - start;
-      std::this_thread::sleep_for(instruction_runtime - elapsed);
+  auto const elapsed  = seconds{stats.elapsed}.count();
+  auto const emulated = seconds{stats.emulated}.count();
+  auto const rate     = [&](double s) {
+    return s > 0 ? double(stats.instructions) / s : 0.0;
+  };
+  os << stats.instructions << " instructions in " << stats.frames
+     << " frames, " << rate(elapsed) << " instructions/s achieved, "
+     << rate(emulated) << " instructions/s target, " << stats.resyncs
+     << " resyncs\n";
+}
+
+/// Write the terminal output statistics of an interactive run.
+auto write_render_stats(std::ostream& os, chip8::Render_stats const& stats)
+  -> void
+{
+  auto const frames = stats.frames_presented;
+  os << frames << " frames presented, " << stats.frames_skipped
+     << " unchanged frames skipped, " << stats.frames_dropped
+     << " frames dropped, " << stats.bytes_written << " bytes, "
+     << (frames > 0 ? stats.bytes_written / frames : 0)
+     << " bytes per frame\n";
+}
+
+/// Read one job per line of \p filepath, blank lines are skipped.
+/** A line is a ROM path, optionally followed by tab separated fields: the
+ *  seed for that machine, a save state to start it from and a file to write
+ *  its save state to when it ends. "-" leaves a field out. */
+auto load_batch(std::string const& filepath) -> std::vector<chip8::Batch_job>
+{
+  auto input = std::ifstream{filepath};
+  if (!input) {
+    throw std::runtime_error{"Error opening batch file: " + filepath};
+  }
+  auto jobs = std::vector<chip8::Batch_job>{};
+  for (auto line = std::string{}; std::getline(input, line);) {
+    if (line.empty()) {
+      continue;
+    }
+    try {
+      auto fields = std::vector<std::string>{};
+      for (auto at = std::size_t{0}; at != std::string::npos;) {
+        auto const tab = line.find('\t', at);
+        fields.push_back(line.substr(at, tab - at));
+        at = tab == std::string::npos ? tab : tab + 1;
+      }
+      if (fields.size() > 4) {
+        throw std::runtime_error{"Too many fields."};
+      }
+      fields.resize(4, "-");
+      auto job    = chip8::Batch_job{};
+      job.name    = fields[0];
+      job.program = chip8::load_program(fields[0]);
+      if (fields[1] != "-") {
+        job.seed = parse_seed("seed", fields[1]);
+      }
+      if (fields[2] != "-") {
+        job.initial_state = chip8::read_state(fields[2]);
+      }
+      if (fields[3] != "-") {
+        job.save_state_filepath = fields[3];
+      }
+      jobs.push_back(std::move(job));
+    }
+    catch (std::exception const& e) {
+      throw std::runtime_error{line + ": " + e.what()};
     }
+  }
+  return jobs;
+}
 
-    esc::uninitialize_terminal();
+/// Run every ROM listed in the batch file and write the summary.
+template <typename Make_backend>
+auto run_batch(Options const& options,
+               std::uint64_t cycles,
+               std::uint64_t per_frame,
+               Make_backend&& make_backend) -> void
+{
+  using namespace chip8;
+  auto const jobs = load_batch(*options.batch_filepath);
+  auto batch             = Batch_options{};
+  batch.cycle_limit      = cycles;
+  batch.cycles_per_frame = per_frame;
+  batch.slice_cycles     = options.slice_cycles;
+  if (options.threads) {
+    batch.thread_count = *options.threads;
+  }
+  batch.seed = options.seed;
+  auto const start   = std::chrono::steady_clock::now();
+  auto const results = chip8::run_batch(jobs, batch, make_backend);
+  auto const seconds =
+    std::chrono::duration<double>{std::chrono::steady_clock::now() - start}
+      .count();
+
+  if (options.summary_filepath) {
+    auto output = std::ofstream{*options.summary_filepath};
+    if (!output) {
+      throw std::runtime_error{"Error opening summary file: " +
+                               *options.summary_filepath};
+    }
+    write_summary(output, results);
+  }
+  else {
+    write_summary(std::cout, results);
+  }
+  auto instructions = std::uint64_t{0};
+  for (auto const& result : results) {
+    instructions += result.report.instructions;
+  }
+  std::clog << results.size() << " machines, " << instructions
+            << " instructions in " << seconds << " s, "
+            << (seconds > 0 ? double(instructions) / seconds / 1'000'000 : 0.0)
+            << " MIPS\n";
+}
+
+auto main(int argc, char* argv[]) -> int
+{
+  using namespace chip8;
+  auto interactive  = false;
+  auto render_stats = std::optional<Render_stats>{};
+  auto pacing_stats = std::optional<Pacing_stats>{};
+  try {
+    auto const options   = parse_command_line(argc, argv);
+    auto const hz        = options.clock_hz.value_or(500);
+    auto const per_frame = std::max<std::uint64_t>(hz / 60, 1);
+    auto const cycles =
+      options.headless
+        ? (options.cycles ? *options.cycles : *options.frames * per_frame)
+        : 0;
+#if DEBUG
+    auto const clock = make_clock_fn(4);
+#else
+    auto const clock = make_clock_fn(options.clock_hz);
+#endif
+    auto const execute = [&](auto&& make_backend) {
+      if (options.batch_filepath) {
+        run_batch(options, cycles, per_frame, make_backend);
+        return;
+      }
+      auto const program = load_program(options.rom_filepath);
+      if (options.replay_filepath) {
+        auto const movie = load_movie(*options.replay_filepath);
+        if (movie.program_hash != program_hash(program)) {
+          throw std::runtime_error{"Movie was recorded with another ROM."};
+        }
+        auto state        = initialize_state(program, movie.seed);
+        auto backend      = make_backend();
+        auto const replay = replay_movie(movie, state, backend);
+        write_report(std::cout, replay.run, state);
+        if (options.save_state_filepath) {
+          save_state(state, *options.save_state_filepath);
+        }
+        if (replay.diverged_at) {
+          throw std::runtime_error{"Replay diverged from the movie at frame " +
+                                   std::to_string(*replay.diverged_at) + "."};
+        }
+        std::clog << replay.run.frames << " of " << movie.frames.size()
+                  << " frames replayed, " << replay.checkpoints
+                  << " checkpoints matched\n";
+        return;
+      }
+      // Interactive runs differ from run to run unless seeded, headless runs
+      // are reproducible either way.
+      auto const seed =
+        options.headless
+          ? options.seed
+          : std::optional{options.seed.value_or(Random_generator::make_seed())};
+      auto state = initialize_state(program, seed);
+      if (options.load_state_filepath) {
+        load_state(*options.load_state_filepath, state);
+      }
+      auto backend = make_backend();
+      if (options.headless) {
+        auto const report = run_headless(state, backend, cycles, per_frame);
+        write_report(std::cout, report, state);
+        if (options.save_state_filepath) {
+          save_state(state, *options.save_state_filepath);
+        }
+        return;
+      }
+      {
+        using namespace esc;
+        initialize_interactive_terminal(Mouse_mode::Off, Key_mode::Normal);
+        interactive = true;
+      }
+      auto input = Input_thread{};
+      state.keyboard.attach(input.keys());
+      auto movie    = std::ofstream{};
+      auto recorder = std::optional<Movie_recorder>{};
+      if (options.record_filepath) {
+        movie.open(*options.record_filepath, std::ios::binary);
+        if (!movie) {
+          throw std::runtime_error{"Error opening movie: " +
+                                   *options.record_filepath};
+        }
+        recorder.emplace(movie, input.keys(), *seed, program);
+        recorder->attach(state);
+      }
+      auto renderer = Render_thread{Renderer{
+        options.render_mode, STDOUT_FILENO, options.sixel_scale}};
+      auto rewind = std::optional<Rewind_buffer>{};
+      if (options.rewind) {
+        rewind.emplace();
+      }
+      pacing_stats = run(state, backend, clock, renderer, options, input,
+                         recorder ? &*recorder : nullptr,
+                         rewind ? &*rewind : nullptr);
+      render_stats = renderer.stop();
+      if (options.save_state_filepath) {
+        save_state(state, *options.save_state_filepath);
+      }
+    };
+    switch (options.backend) {
+      case Backend::Interpreter:
+        execute([] { return Interpreter{}; });
+        break;
+      case Backend::Decode_cache:
+        execute([] { return Decode_cache{}; });
+        break;
+      case Backend::Block_cache:
+        execute([] { return Block_cache{}; });
+        break;
+      case Backend::Jit:
+#ifdef CHIP8_JIT
+        execute([] { return Jit{}; });
+#endif
+        break;
+      case Backend::Threaded:
+#ifdef CHIP8_THREADED
+        // One slice per 60Hz frame.
+        execute([&] { return Threaded_interpreter{per_frame}; });
+#endif
+        break;
+    }
+
+    if (interactive) {
+      esc::uninitialize_terminal();
+    }
+    if (render_stats) {
+      write_render_stats(std::clog, *render_stats);
+    }
+    if (pacing_stats) {
+      write_pacing_stats(std::clog, *pacing_stats);
+    }
     return 0;
   }
   catch (std::exception const& e) {
-    esc::uninitialize_terminal();
+    if (interactive) {
+      esc::uninitialize_terminal();
+    }
     std::cerr << "Fatal Error: " << e.what() << '\n';
     return 1;
   }
@@ -0,0 +1,312 @@
+#ifndef MOVIE_HPP
+#define MOVIE_HPP
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <fstream>
+#include <istream>
+#include <optional>
+#include <ostream>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "headless.hpp"
+#include "idle.hpp"
+#include "keyboard.hpp"
+#include "save_state.hpp"
+#include "state.hpp"
+#include "timer.hpp"
+#include "types.hpp"
+
+namespace chip8 {
+
+/// Version written by Movie_recorder, read_movie() reads only this one.
+inline constexpr auto movie_version = std::uint16_t{1};
+
+/// One 60Hz frame of a recorded run.
+struct Movie_frame {
+  Key_mask keys              = 0;
+  std::uint32_t instructions = 0;
+  bool halted                = false;  // After the frame's instructions.
+  std::optional<std::uint64_t> framebuffer_hash;  // On checkpoint frames.
+};
+
+/// A recorded run: the seed it started from and the keys held and the
+/// instructions executed in each frame.
+struct Movie {
+  std::uint64_t seed             = 0;
+  std::uint64_t program_hash     = 0;
+  std::uint16_t checkpoint_every = 0;
+  std::vector<Movie_frame> frames;
+};
+
+namespace detail {
+
+inline constexpr auto movie_magic = std::array<std::uint8_t, 4>{
+  'C', 'H', '8', 'M'};
+
+inline constexpr auto movie_header_size = std::size_t{4 + 2 + 2 + 8 + 8};
+inline constexpr auto movie_frame_size  = std::size_t{2 + 4};
+inline constexpr auto halted_bit        = std::uint32_t{1} << 31;
+
+}  // namespace detail
+
+/// Return a hash identifying \p program, so a movie is replayed on the ROM it
+/// was recorded with.
+inline auto program_hash(std::vector<char> const& program) -> std::uint64_t
+{
+  return detail::save_state_hash(
+    {reinterpret_cast<std::uint8_t const*>(program.data()), program.size()});
+}
+
+/// Records the keys of an interactive run to a stream, frame by frame.
+/** The keys are latched once per frame, at begin_frame(), and the machine
+ *  reads the latched keys until the next frame. With the instructions each
+ *  frame executes and the seed, this is all replay_movie() needs to rebuild
+ *  the run. Every checkpoint_every frames a framebuffer hash is written too,
+ *  to find where a replay parts from the recording, and the stream is
+ *  flushed, so a recording cut short still replays up to there.
+ *
+ *  Format, little endian: magic "CH8M", version, checkpoint_every, the seed
+ *  and program_hash(), then per frame the keys held as a u16 and the
+ *  instructions executed as a u32, with the top bit set if the program halted
+ *  after them, followed on checkpoint frames by framebuffer_hash() as a u64. */
+class Movie_recorder {
+ public:
+  static constexpr auto default_checkpoint_every = std::uint16_t{60};
+
+ public:
+  /// Write the header to \p output, the keys are read from \p keys.
+  /** \p output and \p keys must outlive the recorder. */
+  Movie_recorder(std::ostream& output,
+                 std::atomic<Key_mask> const& keys,
+                 std::uint64_t seed,
+                 std::vector<char> const& program,
+                 std::uint16_t checkpoint_every = default_checkpoint_every)
+    : output_{output}, keys_{keys}, checkpoint_every_{checkpoint_every}
+  {
+    using namespace detail;
+    if (checkpoint_every == 0) {
+      throw std::invalid_argument{"Movie checkpoint interval must be > 0."};
+    }
+    auto header = std::array<std::uint8_t, movie_header_size>{};
+    auto out    = Save_state_writer{header.data()};
+    for (auto const byte : movie_magic) {
+      out.put(byte);
+    }
+    out.put(movie_version);
+    out.put(checkpoint_every);
+    out.put(seed);
+    out.put(program_hash(program));
+    this->write(header);
+  }
+
+  Movie_recorder(Movie_recorder const&)                    = delete;
+  auto operator=(Movie_recorder const&) -> Movie_recorder& = delete;
+
+ public:
+  /// Attach \p state's keyboard to the keys latched for the frame.
+  auto attach(State& state) const -> void { state.keyboard.attach(latched_); }
+
+  /// Latch the keys held for the frame about to run.
+  auto begin_frame() -> void
+  {
+    latched_.store(keys_.load(std::memory_order_relaxed),
+                   std::memory_order_relaxed);
+    instructions_ = 0;
+  }
+
+  /// Call with each instruction executed.
+  auto on_executed() -> void { ++instructions_; }
+
+  /// Record the frame that began at begin_frame(), \p halted if the program
+  /// halted in it.
+  auto end_frame(State const& state, bool halted = false) -> void
+  {
+    using namespace detail;
+    auto record = std::array<std::uint8_t, movie_frame_size + 8>{};
+    auto out    = Save_state_writer{record.data()};
+    out.put(latched_.load(std::memory_order_relaxed));
+    out.put(instructions_ | (halted ? halted_bit : 0));
+    auto const checkpoint = ++frames_ % checkpoint_every_ == 0;
+    if (checkpoint) {
+      out.put(framebuffer_hash(state));
+    }
+    this->write(
+      std::span{record}.first(movie_frame_size + (checkpoint ? 8 : 0)));
+    if (checkpoint || halted) {
+      output_.flush();
+    }
+  }
+
+  /// Return the frames recorded.
+  auto frames() const -> std::uint64_t { return frames_; }
+
+ private:
+  auto write(std::span<std::uint8_t const> bytes) -> void
+  {
+    output_.write(reinterpret_cast<char const*>(bytes.data()),
+                  std::streamsize(bytes.size()));
+    if (!output_) {
+      throw std::runtime_error{"Error writing movie."};
+    }
+  }
+
+ private:
+  std::ostream& output_;
+  std::atomic<Key_mask> const& keys_;
+  std::atomic<Key_mask> latched_ = 0;
+  std::uint16_t checkpoint_every_;
+  std::uint32_t instructions_ = 0;
+  std::uint64_t frames_       = 0;
+};
+
+/// Read a movie written by Movie_recorder from \p input.
+/** Throws std::runtime_error if \p input is not a movie of this version. A
+ *  frame cut off at the end, by a recording that did not finish, is dropped. */
+inline auto read_movie(std::istream& input) -> Movie
+{
+  using namespace detail;
+  auto const read = [&](std::span<std::uint8_t> bytes) {
+    input.read(reinterpret_cast<char*>(bytes.data()),
+               std::streamsize(bytes.size()));
+    return input.gcount() == std::streamsize(bytes.size());
+  };
+  auto header = std::array<std::uint8_t, movie_header_size>{};
+  if (!read(header)) {
+    throw std::runtime_error{"Not a movie."};
+  }
+  auto in = Save_state_reader{header.data()};
+  for (auto const byte : movie_magic) {
+    if (in.get<std::uint8_t>() != byte) {
+      throw std::runtime_error{"Not a movie."};
+    }
+  }
+  if (in.get<std::uint16_t>() != movie_version) {
+    throw std::runtime_error{"Unsupported movie version."};
+  }
+  auto movie             = Movie{};
+  movie.checkpoint_every = in.get<std::uint16_t>();
+  movie.seed             = in.get<std::uint64_t>();
+  movie.program_hash     = in.get<std::uint64_t>();
+  if (movie.checkpoint_every == 0) {
+    throw std::runtime_error{"Not a movie."};
+  }
+
+  auto record = std::array<std::uint8_t, movie_frame_size>{};
+  auto hash   = std::array<std::uint8_t, 8>{};
+  while (read(record)) {
+    auto frame_in           = Save_state_reader{record.data()};
+    auto frame              = Movie_frame{};
+    frame.keys              = frame_in.get<Key_mask>();
+    auto const instructions = frame_in.get<std::uint32_t>();
+    frame.instructions      = instructions & ~halted_bit;
+    frame.halted            = (instructions & halted_bit) != 0;
+    if ((movie.frames.size() + 1) % movie.checkpoint_every == 0) {
+      if (!read(hash)) {
+        break;
+      }
+      frame.framebuffer_hash =
+        Save_state_reader{hash.data()}.get<std::uint64_t>();
+    }
+    movie.frames.push_back(frame);
+  }
+  return movie;
+}
+
+/// Read the movie in the file at \p filepath, see read_movie().
+inline auto load_movie(std::string const& filepath) -> Movie
+{
+  auto input = std::ifstream{filepath, std::ios::binary};
+  if (!input) {
+    throw std::runtime_error{"Error opening movie: " + filepath};
+  }
+  return read_movie(input);
+}
+
+/// Outcome of replay_movie().
+struct Replay_report {
+  Headless_report run;
+  std::uint64_t checkpoints = 0;  // Checkpoints that matched.
+  std::optional<std::uint64_t> diverged_at;  // Frame of the first mismatch.
+};
+
+/// Replay \p movie on \p state, which must have been initialized with
+/// movie.seed, as fast as the host allows.
+/** Each frame runs the instructions recorded for it with the keys recorded
+ *  for it held, then counts the timers down, as the recorded run did, so the
+ *  replay ends in the State the recording did. Stops at the first checkpoint
+ *  whose framebuffer hash differs. Backends that run several instructions per
+ *  dispatch replay exactly only movies recorded with the same backend, as
+ *  they may not stop where another backend's frame ended. */
+template <typename Backend_t>
+auto replay_movie(Movie const& movie, State& state, Backend_t& backend)
+  -> Replay_report
+{
+  auto report      = Replay_report{};
+  auto& run        = report.run;
+  auto keys        = std::atomic<Key_mask>{0};
+  auto idle        = Idle_detector{};
+  auto target      = std::uint64_t{0};
+  auto const start = std::chrono::steady_clock::now();
+  state.keyboard.attach(keys);
+  auto const on_executed = [&](Instruction_t instruction) {
+    ++run.instructions;
+    idle.on_executed(instruction);
+  };
+  try {
+    for (auto const& frame : movie.frames) {
+      keys.store(frame.keys, std::memory_order_relaxed);
+      target += frame.instructions;
+      while (run.instructions < target) {
+        if (!backend.run(state, on_executed)) {
+          run.halt_reason    = "invalid program counter";
+          report.diverged_at = run.frames;
+          break;
+        }
+        if (auto const loop = idle.check(state)) {
+          // Whole iterations leave State as it was, see resume_headless().
+          run.instructions +=
+            (target - std::min(target, run.instructions)) / *loop * *loop;
+        }
+      }
+      if (!run.halt_reason.empty()) {
+        break;
+      }
+      if (frame.halted) {
+        if (backend.run(state, on_executed)) {
+          report.diverged_at = run.frames;
+        }
+        else {
+          run.halt_reason = "invalid program counter";
+        }
+        break;
+      }
+      tick_timer(state.delay_timer_register);
+      tick_timer(state.sound_timer_register);
+      if (frame.framebuffer_hash) {
+        if (*frame.framebuffer_hash != framebuffer_hash(state)) {
+          report.diverged_at = run.frames;
+          break;
+        }
+        ++report.checkpoints;
+      }
+      ++run.frames;
+    }
+  }
+  catch (std::exception const& e) {
+    run.halt_reason = e.what();
+  }
+  state.keyboard.detach();
+  run.elapsed = std::chrono::steady_clock::now() - start;
+  return report;
+}
+
+}  // namespace chip8
+#endif  // MOVIE_HPP
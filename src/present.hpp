@@ -0,0 +1,54 @@
+#ifndef PRESENT_HPP
+#define PRESENT_HPP
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+namespace chip8 {
+
+/// When the emulation loop hands the framebuffer to the renderer.
+enum class Present_mode {
+  Frame,      // At most once per 60Hz tick, after the tick's instructions.
+  Immediate,  // After every instruction that changes the display.
+};
+
+/// Throws std::runtime_error if \p name is not a known mode.
+inline auto parse_present_mode(std::string const& name) -> Present_mode
+{
+  if (name == "frame") {
+    return Present_mode::Frame;
+  }
+  if (name == "immediate") {
+    return Present_mode::Immediate;
+  }
+  throw std::runtime_error{"Unknown --present: " + name +
+                           ", expected frame or immediate."};
+}
+
+/// Tracks whether the display changed since it was last presented.
+/** In Present_mode::Frame any number of draws within one 60Hz tick are
+ *  presented once, as the finished frame, at the end of the tick. */
+class Present_scheduler {
+ public:
+  explicit Present_scheduler(Present_mode mode) : mode_{mode} {}
+
+ public:
+  /// Call after each instruction that changed the display. Returns true if
+  /// the display should be presented now.
+  auto on_draw() -> bool
+  {
+    dirty_ = true;
+    return mode_ == Present_mode::Immediate && std::exchange(dirty_, false);
+  }
+
+  /// Call at each 60Hz tick. Returns true if the display should be presented
+  /// now.
+  auto on_tick() -> bool { return std::exchange(dirty_, false); }
+
+ private:
+  Present_mode mode_;
+  bool dirty_ = false;
+};
+
+}  // namespace chip8
+#endif  // PRESENT_HPP
@@ -0,0 +1,83 @@
+#ifndef RANDOM_HPP
+#define RANDOM_HPP
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <random>
+
+namespace chip8 {
+
+/// xoshiro128++ pseudo random number generator, 16 bytes of state.
+/** Each machine owns one, so a machine seeded with the same value always
+ *  draws the same numbers. See https://prng.di.unimi.it */
+class Random_generator {
+ public:
+  using Words_t = std::array<std::uint32_t, 4>;
+
+  /// Seed of a default constructed generator.
+  static constexpr auto default_seed = std::uint64_t{0};
+
+ public:
+  /// Return a seed from std::random_device, for runs that should differ.
+  /** Reads from the operating system, do not call it per machine. */
+  static auto make_seed() -> std::uint64_t
+  {
+    auto device = std::random_device{};
+    return (std::uint64_t{device()} << 32) | device();
+  }
+
+ public:
+  /// Seed from default_seed, so unseeded machines are reproducible too.
+  constexpr Random_generator() : Random_generator{default_seed} {}
+
+  /// Seed from \p seed, expanded to the full state with splitmix64.
+  explicit constexpr Random_generator(std::uint64_t seed)
+  {
+    for (auto i = std::size_t{0}; i < state_.size(); i += 2) {
+      seed += 0x9E3779B97F4A7C15;
+      auto z = seed;
+      z      = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9;
+      z      = (z ^ (z >> 27)) * 0x94D049BB133111EB;
+      z ^= z >> 31;
+      state_[i]     = std::uint32_t(z);
+      state_[i + 1] = std::uint32_t(z >> 32);
+    }
+  }
+
+  /// Resume from \p words, as returned by words().
+  explicit constexpr Random_generator(Words_t const& words) : state_{words} {}
+
+ public:
+  /// Return the next number and advance the state.
+  constexpr auto next() -> std::uint32_t
+  {
+    auto& s           = state_;
+    auto const result = std::rotl(s[0] + s[3], 7) + s[0];
+    auto const t      = s[1] << 9;
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = std::rotl(s[3], 11);
+    return result;
+  }
+
+  /// Return the next number's eight most significant bits, the best mixed.
+  constexpr auto next_byte() -> std::uint8_t
+  {
+    return static_cast<std::uint8_t>(this->next() >> 24);
+  }
+
+  /// Return the full state, for saving.
+  constexpr auto words() const -> Words_t const& { return state_; }
+
+  constexpr auto operator==(Random_generator const&) const -> bool = default;
+
+ private:
+  Words_t state_{};
+};
+
+}  // namespace chip8
+#endif  // RANDOM_HPP
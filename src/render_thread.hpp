@@ -0,0 +1,88 @@
+#ifndef RENDER_THREAD_HPP
+#define RENDER_THREAD_HPP
+#include <atomic>
+#include <cstdint>
+#include <thread>
+#include <utility>
+
+#include "framebuffer.hpp"
+#include "screen.hpp"
+#include "triple_buffer.hpp"
+
+namespace chip8 {
+
+/// Presents framebuffer snapshots on a thread of its own.
+/** The emulation thread publishes snapshots through a Triple_buffer and never
+ *  waits on the terminal. The render thread wakes on each publish and
+ *  presents the latest snapshot, snapshots published while it is still
+ *  writing the previous one are dropped. How often to publish is up to the
+ *  caller, see Present_scheduler. */
+class Render_thread {
+ public:
+  /// Present through \p renderer.
+  explicit Render_thread(Renderer renderer = Renderer{})
+    : renderer_{std::move(renderer)}, thread_{[this] { this->render(); }}
+  {}
+
+  Render_thread(Render_thread const&)                    = delete;
+  auto operator=(Render_thread const&) -> Render_thread& = delete;
+
+  ~Render_thread() { this->stop(); }
+
+ public:
+  /// Hand a copy of \p screen to the render thread. Call from one thread only.
+  auto publish(Framebuffer const& screen) -> void
+  {
+    frames_.write_buffer() = screen;
+    if (!frames_.publish()) {
+      dropped_.fetch_add(1, std::memory_order_relaxed);
+    }
+    published_.fetch_add(1, std::memory_order_release);
+    published_.notify_one();
+  }
+
+  /// Present the last published snapshot and stop the render thread.
+  /** Returns the statistics of the whole run. */
+  auto stop() -> Render_stats
+  {
+    if (thread_.joinable()) {
+      stopping_.store(true, std::memory_order_relaxed);
+      published_.fetch_add(1, std::memory_order_release);
+      published_.notify_one();
+      thread_.join();
+    }
+    auto stats           = renderer_.stats();
+    stats.frames_dropped = dropped_.load(std::memory_order_relaxed);
+    return stats;
+  }
+
+ private:
+  auto render() -> void
+  {
+    auto seen = std::uint32_t{0};
+    while (!stopping_.load(std::memory_order_relaxed)) {
+      published_.wait(seen, std::memory_order_acquire);
+      seen = published_.load(std::memory_order_acquire);
+      this->present_latest();
+    }
+    this->present_latest();
+  }
+
+  auto present_latest() -> void
+  {
+    if (frames_.update()) {
+      renderer_.present(frames_.read_buffer());
+    }
+  }
+
+ private:
+  Renderer renderer_;  // Used only by the render thread while it runs.
+  Triple_buffer<Framebuffer> frames_;
+  std::atomic<std::uint64_t> dropped_   = 0;
+  std::atomic<std::uint32_t> published_ = 0;  // Wakes the render thread.
+  std::atomic<bool> stopping_           = false;
+  std::thread thread_;  // Last, it uses the members above.
+};
+
+}  // namespace chip8
+#endif  // RENDER_THREAD_HPP
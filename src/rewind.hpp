@@ -0,0 +1,226 @@
+#ifndef REWIND_HPP
+#define REWIND_HPP
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <vector>
+
+#include "save_state.hpp"
+#include "state.hpp"
+
+namespace chip8 {
+
+/// Keeps the last frames of a machine in a fixed amount of memory, to step
+/// back to.
+/** Each capture() takes a save state, see encode_state(). The newest is kept
+ *  whole, every older one as the XOR against the one after it, with runs of
+ *  unchanged bytes run length encoded. A frame usually changes a few
+ *  registers and some memory and display rows, so entries are tens of bytes.
+ *  The entries live in a ring of capacity bytes; when it is full, the oldest
+ *  frames are forgotten. */
+class Rewind_buffer {
+ public:
+  /// Minutes of history for most programs.
+  static constexpr auto default_capacity = std::size_t{4} << 20;
+
+ public:
+  explicit Rewind_buffer(std::size_t capacity = default_capacity)
+    : ring_(capacity)
+  {
+    delta_.reserve(max_delta_size);
+  }
+
+ public:
+  /// Record \p state as the newest frame.
+  auto capture(State const& state) -> void
+  {
+    encode_state(state, next_);
+    if (has_newest_) {
+      this->encode_delta();
+      this->push();
+    }
+    newest_     = next_;
+    has_newest_ = true;
+  }
+
+  /// Restore \p state to the frame \p frames captures before the newest and
+  /// forget the frames after it, which makes it the newest.
+  /** Steps back no further than the oldest frame held, returns the number of
+   *  frames stepped back. Does nothing and returns 0 before any capture. */
+  auto rewind(std::size_t frames, State& state) -> std::size_t
+  {
+    if (!has_newest_) {
+      return 0;
+    }
+    auto stepped = std::size_t{0};
+    for (; stepped < frames && count_ > 0; ++stepped) {
+      this->pop();
+      this->apply_delta();
+    }
+    decode_state(newest_, state);
+    return stepped;
+  }
+
+  /// Return the number of frames rewind() can step back.
+  auto frames() const -> std::size_t { return count_; }
+
+  /// Return the bytes of the ring in use.
+  auto bytes_used() const -> std::size_t { return used_; }
+
+  /// Forget every frame.
+  auto clear() -> void
+  {
+    begin_      = 0;
+    used_       = 0;
+    count_      = 0;
+    has_newest_ = false;
+  }
+
+ private:
+  using Length_t = std::uint32_t;
+
+  /// Each run of unchanged bytes and the changed bytes after it are stored as
+  /// two Run_t lengths, then the changed bytes. A changed run ends at the
+  /// first min_unchanged_run unchanged bytes.
+  using Run_t = std::uint16_t;
+
+  static constexpr auto min_unchanged_run = std::size_t{4};
+
+  static_assert(save_state_size <= 0xFFFF);
+
+  static constexpr auto max_delta_size =
+    save_state_size + 2 * sizeof(Run_t) * (save_state_size / 2 + 1);
+
+  /// Write next_ XOR newest_ to delta_.
+  auto encode_delta() -> void
+  {
+    delta_.clear();
+    auto const put_run = [this](std::size_t length) {
+      delta_.push_back(std::uint8_t(length));
+      delta_.push_back(std::uint8_t(length >> 8));
+    };
+    auto at = std::size_t{0};
+    while (at < save_state_size) {
+      auto const unchanged_from = at;
+      while (at + 8 <= save_state_size &&
+             std::memcmp(next_.data() + at, newest_.data() + at, 8) == 0) {
+        at += 8;
+      }
+      while (at < save_state_size && next_[at] == newest_[at]) {
+        ++at;
+      }
+      auto const changed_from = at;
+      auto changed_to         = at;
+      while (at < save_state_size) {
+        if (next_[at] != newest_[at]) {
+          changed_to = ++at;
+        }
+        else if (at - changed_to < min_unchanged_run) {
+          ++at;
+        }
+        else {
+          break;
+        }
+      }
+      at = changed_to;
+      put_run(changed_from - unchanged_from);
+      put_run(changed_to - changed_from);
+      for (auto i = changed_from; i < changed_to; ++i) {
+        delta_.push_back(std::uint8_t(next_[i] ^ newest_[i]));
+      }
+    }
+  }
+
+  /// XOR delta_ into newest_.
+  auto apply_delta() -> void
+  {
+    auto const get_run = [this](std::size_t& in) {
+      auto const length = std::size_t(delta_[in] | (delta_[in + 1] << 8));
+      in += sizeof(Run_t);
+      return length;
+    };
+    auto in = std::size_t{0};
+    auto at = std::size_t{0};
+    while (in < delta_.size()) {
+      at += get_run(in);
+      auto const changed = get_run(in);
+      for (auto i = std::size_t{0}; i < changed; ++i) {
+        newest_[at++] ^= delta_[in++];
+      }
+    }
+  }
+
+  /// Append delta_ as the newest entry, stored as its length, the delta and
+  /// its length again, so entries can be walked from either end.
+  auto push() -> void
+  {
+    auto const length = Length_t(delta_.size());
+    auto const needed = delta_.size() + 2 * sizeof(Length_t);
+    if (needed > ring_.size()) {
+      this->clear();
+      return;
+    }
+    while (ring_.size() - used_ < needed) {
+      auto oldest = Length_t{0};
+      this->read(begin_, {reinterpret_cast<std::uint8_t*>(&oldest),
+                          sizeof(oldest)});
+      auto const size = oldest + 2 * sizeof(Length_t);
+      begin_          = (begin_ + size) % ring_.size();
+      used_ -= size;
+      --count_;
+    }
+    auto const bytes = std::span{
+      reinterpret_cast<std::uint8_t const*>(&length), sizeof(length)};
+    auto const end = begin_ + used_;
+    this->write(end, bytes);
+    this->write(end + sizeof(Length_t), delta_);
+    this->write(end + sizeof(Length_t) + delta_.size(), bytes);
+    used_ += needed;
+    ++count_;
+  }
+
+  /// Move the newest entry into delta_ and remove it.
+  auto pop() -> void
+  {
+    auto length = Length_t{0};
+    this->read(begin_ + used_ - sizeof(Length_t),
+               {reinterpret_cast<std::uint8_t*>(&length), sizeof(length)});
+    delta_.resize(length);
+    this->read(begin_ + used_ - sizeof(Length_t) - length, delta_);
+    used_ -= length + 2 * sizeof(Length_t);
+    --count_;
+  }
+
+  /// Copy \p bytes into the ring from offset \p at, wrapping around its end.
+  auto write(std::size_t at, std::span<std::uint8_t const> bytes) -> void
+  {
+    at              = at % ring_.size();
+    auto const head = std::min(bytes.size(), ring_.size() - at);
+    std::memcpy(ring_.data() + at, bytes.data(), head);
+    std::memcpy(ring_.data(), bytes.data() + head, bytes.size() - head);
+  }
+
+  /// Copy bytes out of the ring from offset \p at, wrapping around its end.
+  auto read(std::size_t at, std::span<std::uint8_t> bytes) const -> void
+  {
+    at              = at % ring_.size();
+    auto const head = std::min(bytes.size(), ring_.size() - at);
+    std::memcpy(bytes.data(), ring_.data() + at, head);
+    std::memcpy(bytes.data() + head, ring_.data(), bytes.size() - head);
+  }
+
+ private:
+  std::vector<std::uint8_t> ring_;
+  std::size_t begin_ = 0;  // Offset of the oldest entry.
+  std::size_t used_  = 0;
+  std::size_t count_ = 0;
+  std::vector<std::uint8_t> delta_;
+  Save_state_t newest_{};
+  Save_state_t next_{};
+  bool has_newest_ = false;
+};
+
+}  // namespace chip8
+#endif  // REWIND_HPP
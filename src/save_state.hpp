@@ -0,0 +1,265 @@
+#ifndef SAVE_STATE_HPP
+#define SAVE_STATE_HPP
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <span>
+#include <stdexcept>
+#include <string>
+
+#include "constants.hpp"
+#include "framebuffer.hpp"
+#include "random.hpp"
+#include "state.hpp"
+#include "types.hpp"
+
+namespace chip8 {
+
+/// Version written by encode_state(), decode_state() reads only this one.
+inline constexpr auto save_state_version = std::uint16_t{1};
+
+/// Size of a save state, in bytes.
+/** Magic "CH8S", version and a reserved word, then the payload and a hash of
+ *  the payload, FNV-1a over its little endian 64 bit words and then its last
+ *  bytes. Multi-byte fields are little endian. The payload is, in order:
+ *  V0-VF, I, the program counter, the stack, the stack pointer, the delay and
+ *  sound timers, the Fx0A wait flag, the keys held, the random generator, the
+ *  framebuffer rows and memory. */
+inline constexpr auto save_state_size = std::size_t{
+  4 + 2 + 2 + 16 + 2 + 2 + 16 * 2 + 1 + 1 + 1 + 1 + 2 + 4 * 4 +
+  Framebuffer::height * 8 + MEMORY_AMOUNT + 8};
+
+/// A save state held in memory.
+using Save_state_t = std::array<std::uint8_t, save_state_size>;
+
+namespace detail {
+
+inline constexpr auto save_state_magic = std::array<std::uint8_t, 4>{
+  'C', 'H', '8', 'S'};
+
+inline constexpr auto save_state_header = std::size_t{8};
+
+/// Offset of the stack pointer, after V0-VF, I, the program counter and the
+/// stack.
+inline constexpr auto save_state_stack_pointer =
+  save_state_header + 16 + 2 + 2 + 16 * 2;
+
+inline auto save_state_hash(std::span<std::uint8_t const> payload)
+  -> std::uint64_t
+{
+  constexpr auto prime = std::uint64_t{0x100000001b3};
+  auto hash            = std::uint64_t{0xcbf29ce484222325};
+  auto at              = std::size_t{0};
+  for (; at + 8 <= payload.size(); at += 8) {
+    auto word = std::uint64_t{0};
+    for (auto i = std::size_t{0}; i < 8; ++i) {
+      word |= std::uint64_t{payload[at + i]} << (8 * i);
+    }
+    hash = (hash ^ word) * prime;
+  }
+  for (; at < payload.size(); ++at) {
+    hash = (hash ^ payload[at]) * prime;
+  }
+  return hash;
+}
+
+/// Writes little endian fields one after another.
+class Save_state_writer {
+ public:
+  explicit Save_state_writer(std::uint8_t* at) : at_{at} {}
+
+  template <typename T>
+  auto put(T value) -> void
+  {
+    for (auto i = std::size_t{0}; i < sizeof(T); ++i) {
+      *at_++ = std::uint8_t(std::uint64_t(value) >> (8 * i));
+    }
+  }
+
+  auto put_bytes(std::span<std::uint8_t const> bytes) -> void
+  {
+    std::memcpy(at_, bytes.data(), bytes.size());
+    at_ += bytes.size();
+  }
+
+ private:
+  std::uint8_t* at_;
+};
+
+/// Reads the fields Save_state_writer writes.
+class Save_state_reader {
+ public:
+  explicit Save_state_reader(std::uint8_t const* at) : at_{at} {}
+
+  template <typename T>
+  auto get() -> T
+  {
+    auto value = std::uint64_t{0};
+    for (auto i = std::size_t{0}; i < sizeof(T); ++i) {
+      value |= std::uint64_t{*at_++} << (8 * i);
+    }
+    return T(value);
+  }
+
+  auto get_bytes(std::span<std::uint8_t> bytes) -> void
+  {
+    std::memcpy(bytes.data(), at_, bytes.size());
+    at_ += bytes.size();
+  }
+
+ private:
+  std::uint8_t const* at_;
+};
+
+}  // namespace detail
+
+/// Write a save state of \p state into \p buffer.
+/** The timers' host clock and the keyboard attachment are not saved. */
+inline auto encode_state(State const& state,
+                         std::span<std::uint8_t, save_state_size> buffer)
+  -> void
+{
+  using namespace detail;
+  auto out = Save_state_writer{buffer.data()};
+  for (auto const byte : save_state_magic) {
+    out.put(byte);
+  }
+  out.put(save_state_version);
+  out.put(std::uint16_t{0});
+  for (auto const v : state.general_purpose_registers) {
+    out.put(v);
+  }
+  out.put(state.index_register);
+  out.put(state.program_counter);
+  for (auto const address : state.instruction_stack) {
+    out.put(address);
+  }
+  out.put(state.stack_pointer);
+  out.put(state.delay_timer_register.value);
+  out.put(state.sound_timer_register.value);
+  out.put(std::uint8_t(state.waiting_for_key));
+  out.put(state.keyboard.get_state());
+  for (auto const word : state.random_generator.words()) {
+    out.put(word);
+  }
+  for (auto const row : state.screen_buffer.rows()) {
+    out.put(row);
+  }
+  out.put_bytes(state.memory);
+  auto const payload = buffer.subspan(
+    save_state_header, save_state_size - save_state_header - 8);
+  Save_state_writer{buffer.data() + save_state_size - 8}.put(
+    save_state_hash(payload));
+}
+
+/// Return a save state of \p state.
+inline auto encode_state(State const& state) -> Save_state_t
+{
+  auto buffer = Save_state_t{};
+  encode_state(state, buffer);
+  return buffer;
+}
+
+/// Restore \p state from the save state in \p buffer.
+/** Throws std::runtime_error, leaving \p state unchanged, if \p buffer is not
+ *  a save state of this version, fails its checksum or holds a stack pointer
+ *  past the stack. The timers continue from now and the keyboard stays
+ *  attached as it was, the keys held when saving are not restored. */
+inline auto decode_state(std::span<std::uint8_t const> buffer, State& state)
+  -> void
+{
+  using namespace detail;
+  if (buffer.size() != save_state_size) {
+    throw std::runtime_error{"Save state has the wrong size."};
+  }
+  auto in = Save_state_reader{buffer.data()};
+  for (auto const byte : save_state_magic) {
+    if (in.get<std::uint8_t>() != byte) {
+      throw std::runtime_error{"Not a save state."};
+    }
+  }
+  if (in.get<std::uint16_t>() != save_state_version) {
+    throw std::runtime_error{"Unsupported save state version."};
+  }
+  in.get<std::uint16_t>();
+  auto const payload = buffer.subspan(
+    save_state_header, save_state_size - save_state_header - 8);
+  auto const hash = Save_state_reader{buffer.data() + save_state_size - 8}
+                      .get<std::uint64_t>();
+  if (hash != save_state_hash(payload)) {
+    throw std::runtime_error{"Save state checksum mismatch."};
+  }
+  constexpr auto stack_size =
+    std::tuple_size_v<decltype(State::instruction_stack)>;
+  if (buffer[save_state_stack_pointer] >= stack_size) {
+    throw std::runtime_error{"Save state stack pointer is out of range."};
+  }
+
+  for (auto& v : state.general_purpose_registers) {
+    v = in.get<std::uint8_t>();
+  }
+  state.index_register  = in.get<std::uint16_t>();
+  state.program_counter = in.get<Address_t>();
+  for (auto& address : state.instruction_stack) {
+    address = in.get<Address_t>();
+  }
+  state.stack_pointer              = in.get<std::uint8_t>();
+  state.delay_timer_register.value = in.get<std::uint8_t>();
+  state.sound_timer_register.value = in.get<std::uint8_t>();
+  state.waiting_for_key            = in.get<std::uint8_t>() != 0;
+  in.get<Key_mask>();
+  auto words = Random_generator::Words_t{};
+  for (auto& word : words) {
+    word = in.get<std::uint32_t>();
+  }
+  state.random_generator = Random_generator{words};
+  for (auto y = std::size_t{0}; y < Framebuffer::height; ++y) {
+    state.screen_buffer.set_row(y, in.get<Framebuffer::Row_t>());
+  }
+  in.get_bytes(state.memory);
+  auto const now                             = Clock_t::now();
+  state.delay_timer_register.previous_update = now;
+  state.sound_timer_register.previous_update = now;
+}
+
+/// Write a save state of \p state to the file at \p filepath.
+inline auto save_state(State const& state, std::string const& filepath)
+  -> void
+{
+  auto const buffer = encode_state(state);
+  auto output       = std::ofstream{filepath, std::ios::binary};
+  output.write(reinterpret_cast<char const*>(buffer.data()), buffer.size());
+  if (!output) {
+    throw std::runtime_error{"Error writing save state: " + filepath};
+  }
+}
+
+/// Return the save state in the file at \p filepath, to decode_state() later.
+/** Throws std::runtime_error if the file cannot be read or has the wrong
+ *  size, the contents are checked by decode_state(). */
+inline auto read_state(std::string const& filepath) -> Save_state_t
+{
+  auto input = std::ifstream{filepath, std::ios::binary};
+  if (!input) {
+    throw std::runtime_error{"Error opening save state: " + filepath};
+  }
+  auto buffer = Save_state_t{};
+  input.read(reinterpret_cast<char*>(buffer.data()), buffer.size());
+  if (input.gcount() != std::streamsize(buffer.size()) ||
+      input.peek() != std::ifstream::traits_type::eof()) {
+    throw std::runtime_error{"Save state has the wrong size."};
+  }
+  return buffer;
+}
+
+/// Restore \p state from the save state in the file at \p filepath.
+/** See decode_state(). */
+inline auto load_state(std::string const& filepath, State& state) -> void
+{
+  decode_state(read_state(filepath), state);
+}
+
+}  // namespace chip8
+#endif  // SAVE_STATE_HPP
@@ -0,0 +1,94 @@
+#ifndef SCHEDULER_HPP
+#define SCHEDULER_HPP
+#include <chrono>
+#include <cstdint>
+#include <thread>
+
+namespace chip8 {
+
+/// Speed a Cycle_scheduler achieved.
+/** Only instructions passed to spend() are counted. The rest of a frame given
+ *  up with wait_for_vblank() counts as emulated time without instructions. */
+struct Pacing_stats {
+  std::uint64_t frames       = 0;
+  std::uint64_t instructions = 0;
+  std::chrono::nanoseconds emulated{0};  // Time the instructions take.
+  std::chrono::nanoseconds elapsed{0};   // Host time since the start.
+  std::uint64_t resyncs = 0;  // Times the host fell too far behind to catch up.
+};
+
+/// Paces emulation in 60Hz frames.
+/** Each frame gets a budget of one frame period of emulated time, which the
+ *  caller spends by running instructions back to back. begin_frame() then
+ *  sleeps once, until an absolute deadline, so sleep overshoot in one frame is
+ *  taken out of the next rather than accumulating. Budget overrun carries
+ *  into the next frame for the same reason. */
+class Cycle_scheduler {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  static constexpr auto frame_period =
+    std::chrono::nanoseconds{std::chrono::seconds{1}} / 60;
+
+ public:
+  /// A host that falls more than \p max_lag behind skips ahead instead of
+  /// running frames back to back to catch up.
+  explicit Cycle_scheduler(std::chrono::nanoseconds max_lag = 4 * frame_period)
+    : max_lag_{max_lag}, start_{Clock::now()}, deadline_{start_}
+  {}
+
+ public:
+  /// Wait for the next frame to start and add a frame to the budget.
+  auto begin_frame() -> void
+  {
+    auto const now = Clock::now();
+    if (now < deadline_) {
+      std::this_thread::sleep_until(deadline_);
+    }
+    else if (now - deadline_ > max_lag_) {
+      deadline_ = now;
+      ++stats_.resyncs;
+    }
+    deadline_ += frame_period;
+    budget_ += frame_period;
+    ++stats_.frames;
+  }
+
+  /// Record an instruction that takes \p duration on the emulated machine.
+  auto spend(std::chrono::nanoseconds duration) -> void
+  {
+    budget_ -= duration;
+    stats_.emulated += duration;
+    ++stats_.instructions;
+  }
+
+  /// Spend what is left of the current frame, as an instruction waiting for
+  /// the next display interrupt or for a key does.
+  auto wait_for_vblank() -> void
+  {
+    if (budget_.count() > 0) {
+      stats_.emulated += budget_;
+      budget_ = std::chrono::nanoseconds{0};
+    }
+  }
+
+  /// Return true while the current frame has emulated time left.
+  auto in_budget() const -> bool { return budget_.count() > 0; }
+
+  auto stats() const -> Pacing_stats
+  {
+    auto stats    = stats_;
+    stats.elapsed = Clock::now() - start_;
+    return stats;
+  }
+
+ private:
+  std::chrono::nanoseconds max_lag_;
+  Clock::time_point start_;
+  Clock::time_point deadline_;  // Start of the next frame.
+  std::chrono::nanoseconds budget_{0};
+  Pacing_stats stats_;
+};
+
+}  // namespace chip8
+#endif  // SCHEDULER_HPP
@@ -1,9 +1,23 @@
 #ifndef SCREEN_HPP
 #define SCREEN_HPP
-#include <esc/io.hpp>
-#include <esc/sequence.hpp>
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <variant>
+#include <vector>
 
-#include "esc/sequence.hpp"
+#include <unistd.h>
+
+#include "framebuffer.hpp"
 #include "instructions.hpp"
 #include "types.hpp"
 #include "state.hpp"
@@ -14,68 +28,562 @@ inline auto is_graphics_instruction(Instruction_t instruction) -> bool
   return opcode(instruction) == 0xD || instruction == 0x00E0;
 }
 
-// #define BRAILLE
+/// Terminal output counters of a Renderer.
+struct Render_stats {
+  std::uint64_t frames_presented = 0;
+  std::uint64_t frames_skipped   = 0;  // Identical to the previous frame.
+  std::uint64_t frames_dropped   = 0;  // Replaced before they were presented.
+  std::uint64_t bytes_written    = 0;
+  std::uint64_t last_frame_bytes = 0;
+  std::uint64_t write_calls      = 0;  // write(2) system calls.
+};
 
-inline auto update_graphics(State const& state) -> void
+/// Write all of \p output to \p fd, returns false on error.
+inline auto write_all(int fd, std::string_view output, Render_stats& stats)
+  -> bool
 {
-  esc::write(esc::escape(esc::Cursor_position{0, 0}));
-  auto const& buffer = state.screen_buffer;
-#ifdef BRAILLE
-  for (auto y = 0; y < 8; ++y) {
-    for (auto x = 0; x < 32; ++x) {
-      auto const y_off = y * 4;
-      auto const x_off = x * 2;
-      auto base        = U'⠀';
-      if (buffer[y_off + 0][x_off + 0]) {
-        base |= U'⠁';
+  while (!output.empty()) {
+    auto const written = ::write(fd, output.data(), output.size());
+    ++stats.write_calls;
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    output.remove_prefix(std::size_t(written));
+  }
+  return true;
+}
+
+/// UTF-8 encoding of a single character.
+struct Glyph {
+  std::array<char, 4> bytes{};
+  std::uint8_t size = 0;
+};
+
+constexpr auto encode_utf8(char32_t c) -> Glyph
+{
+  auto glyph = Glyph{};
+  auto& b    = glyph.bytes;
+  if (c < 0x80) {
+    b[0]       = char(c);
+    glyph.size = 1;
+  }
+  else if (c < 0x800) {
+    b[0]       = char(0xC0 | (c >> 6));
+    b[1]       = char(0x80 | (c & 0x3F));
+    glyph.size = 2;
+  }
+  else if (c < 0x10000) {
+    b[0]       = char(0xE0 | (c >> 12));
+    b[1]       = char(0x80 | ((c >> 6) & 0x3F));
+    b[2]       = char(0x80 | (c & 0x3F));
+    glyph.size = 3;
+  }
+  else {
+    b[0]       = char(0xF0 | (c >> 18));
+    b[1]       = char(0x80 | ((c >> 12) & 0x3F));
+    b[2]       = char(0x80 | ((c >> 6) & 0x3F));
+    b[3]       = char(0x80 | (c & 0x3F));
+    glyph.size = 4;
+  }
+  return glyph;
+}
+
+// Cell types of a Cell_renderer. A tile is the pixels of one cell packed row
+// by row, top left pixel in the most significant bit.
+
+/// One pixel column of two rows per cell, 64x16 cells.
+struct Half_block_cell {
+  static constexpr auto width  = std::size_t{1};
+  static constexpr auto height = std::size_t{2};
+
+  static constexpr auto glyph(std::size_t tile) -> char32_t
+  {
+    constexpr auto blocks = std::array{U' ', U'▄', U'▀', U'█'};
+    return blocks[tile];
+  }
+};
+
+/// Braille patterns, two pixel columns of four rows per cell, 32x8 cells.
+struct Braille_cell {
+  static constexpr auto width  = std::size_t{2};
+  static constexpr auto height = std::size_t{4};
+
+  static constexpr auto glyph(std::size_t tile) -> char32_t
+  {
+    // Dot of each tile bit, from the most significant bit.
+    constexpr auto dots = std::array<char32_t, 8>{
+      0x01, 0x08, 0x02, 0x10, 0x04, 0x20, 0x40, 0x80};
+    auto c = U'⠀';
+    for (auto bit = std::size_t{0}; bit < dots.size(); ++bit) {
+      if (tile & (0x80 >> bit)) {
+        c |= dots[bit];
+      }
+    }
+    return c;
+  }
+};
+
+/// Block sextants, two pixel columns of three rows per cell, 32x11 cells. The
+/// bottom row of cells is two pixels high.
+struct Sextant_cell {
+  static constexpr auto width  = std::size_t{2};
+  static constexpr auto height = std::size_t{3};
+
+  static constexpr auto glyph(std::size_t tile) -> char32_t
+  {
+    // Sextant n is bit n-1 of the pattern, numbered row by row from the top
+    // left, so the pattern is the tile with its bits reversed.
+    auto pattern = std::size_t{0};
+    for (auto bit = std::size_t{0}; bit < 6; ++bit) {
+      pattern |= ((tile >> bit) & 1) << (5 - bit);
+    }
+    // U+1FB00 onward skips the patterns that already had block elements.
+    switch (pattern) {
+      case 0b000000: return U' ';
+      case 0b010101: return U'▌';
+      case 0b101010: return U'▐';
+      case 0b111111: return U'█';
+    }
+    return char32_t(0x1FB00 + pattern - 1 - (pattern > 0b010101 ? 1 : 0) -
+                    (pattern > 0b101010 ? 1 : 0));
+  }
+};
+
+/// Draws the framebuffer to the terminal, one glyph of Cell_t per cell.
+/** Keeps the last frame it presented and rewrites only the cells that changed
+ *  since, moving the cursor between runs of changed cells. A frame is encoded
+ *  into a buffer allocated once and written with a single write(2). */
+template <typename Cell_t>
+class Cell_renderer {
+ public:
+  static constexpr auto columns = Framebuffer::width / Cell_t::width;
+  static constexpr auto rows =
+    (Framebuffer::height + Cell_t::height - 1) / Cell_t::height;
+
+ public:
+  /// Write frames to the file descriptor \p fd.
+  explicit Cell_renderer(int fd = STDOUT_FILENO) : fd_{fd} {}
+
+ public:
+  /// Return the terminal output that updates the last encoded frame to
+  /// \p screen, empty if nothing changed.
+  /** The view is valid until the next call. */
+  auto encode(Framebuffer const& screen) -> std::string_view
+  {
+    size_ = 0;
+    cursor_.reset();
+    for (auto row = std::size_t{0}; row < rows; ++row) {
+      auto lines   = Lines{};
+      auto changed = previous_ ? Framebuffer::Row_t{0} : ~Framebuffer::Row_t{0};
+      for (auto k = std::size_t{0}; k < Cell_t::height; ++k) {
+        auto const y = row * Cell_t::height + k;
+        if (y < Framebuffer::height) {
+          lines[k] = screen.row(y);
+          changed |= previous_ ? lines[k] ^ previous_->row(y) : 0;
+        }
+      }
+      if (changed == 0) {
+        continue;
+      }
+      for (auto column = std::size_t{0}; column < columns; ++column) {
+        if (tile_bits(changed, column) != 0) {
+          this->write_cell(lines, column, row);
+        }
+      }
+    }
+    previous_ = screen;
+    return {output_.data(), size_};
+  }
+
+  /// Write the cells of \p screen that changed since the last call.
+  auto present(Framebuffer const& screen) -> void
+  {
+    auto const output = this->encode(screen);
+    if (output.empty()) {
+      ++stats_.frames_skipped;
+      return;
+    }
+    if (!write_all(fd_, output, stats_)) {
+      previous_.reset();  // Unknown what made it out, redraw everything.
+      return;
+    }
+    ++stats_.frames_presented;
+    stats_.bytes_written += output.size();
+    stats_.last_frame_bytes = output.size();
+  }
+
+  auto stats() const -> Render_stats const& { return stats_; }
+
+ private:
+  using Lines = std::array<Framebuffer::Row_t, Cell_t::height>;
+
+  struct Cursor {
+    std::size_t column;
+    std::size_t row;
+  };
+
+  /// Unchanged cells are rewritten rather than jumped over when the gap is at
+  /// most this wide, a cursor move costs more bytes than a few glyphs.
+  static constexpr auto max_gap = std::size_t{2};
+
+  /// Longest cursor move, "ESC [ row ; column H" with three digit numbers.
+  static constexpr auto max_move_size = std::size_t{10};
+
+  /// Every cell changed, each after a cursor move.
+  static constexpr auto max_frame_size =
+    rows * columns * (max_move_size + sizeof(Glyph::bytes));
+
+  static constexpr auto glyphs = [] {
+    auto table = std::array<Glyph, 1u << (Cell_t::width * Cell_t::height)>{};
+    for (auto tile = std::size_t{0}; tile < table.size(); ++tile) {
+      table[tile] = encode_utf8(Cell_t::glyph(tile));
+    }
+    return table;
+  }();
+
+ private:
+  /// Return the Cell_t::width pixels of \p line that fall in \p column.
+  static auto tile_bits(Framebuffer::Row_t line, std::size_t column)
+    -> std::size_t
+  {
+    auto const shift = Framebuffer::width - (column + 1) * Cell_t::width;
+    return (line >> shift) & ((1u << Cell_t::width) - 1);
+  }
+
+  static auto tile(Lines const& lines, std::size_t column) -> std::size_t
+  {
+    auto bits = std::size_t{0};
+    for (auto const line : lines) {
+      bits = (bits << Cell_t::width) | tile_bits(line, column);
+    }
+    return bits;
+  }
+
+  auto write_cell(Lines const& lines, std::size_t column, std::size_t row)
+    -> void
+  {
+    auto const gap = cursor_ && cursor_->row == row && cursor_->column <= column
+                       ? std::optional{column - cursor_->column}
+                       : std::nullopt;
+    if (gap && *gap <= max_gap) {
+      for (auto c = cursor_->column; c < column; ++c) {
+        this->append(glyphs[tile(lines, c)]);
+      }
+    }
+    else {
+      this->append_move(column, row);
+    }
+    this->append(glyphs[tile(lines, column)]);
+    cursor_ = Cursor{column + 1, row};
+  }
+
+  auto append(Glyph const& glyph) -> void
+  {
+    std::memcpy(output_.data() + size_, glyph.bytes.data(), glyph.bytes.size());
+    size_ += glyph.size;
+  }
+
+  /// Append the cursor move of esc::Cursor_position{column, row}.
+  auto append_move(std::size_t column, std::size_t row) -> void
+  {
+    auto const append_number = [this](std::size_t n) {
+      auto const end = output_.data() + output_.size();
+      size_ = std::size_t(std::to_chars(output_.data() + size_, end, n).ptr -
+                          output_.data());
+    };
+    output_[size_++] = '\x1b';
+    output_[size_++] = '[';
+    append_number(row + 1);
+    output_[size_++] = ';';
+    append_number(column + 1);
+    output_[size_++] = 'H';
+  }
+
+ private:
+  int fd_;
+  std::array<char, max_frame_size> output_;
+  std::size_t size_ = 0;  // Bytes of output_ in use.
+  std::optional<Framebuffer> previous_;
+  std::optional<Cursor> cursor_;  // Where the next glyph of output_ goes.
+  Render_stats stats_;
+};
+
+/// Draws the framebuffer as a Sixel image, each pixel as a square of
+/// scale x scale image pixels.
+/** The image is drawn in bands of six image pixel rows. The encoding of each
+ *  band is cached and only bands whose pixels changed are encoded again. The
+ *  image background is transparent, so a band that is already on screen is
+ *  sent as an empty band and a band that is not paints its lit and unlit
+ *  pixels in two passes. All buffers are allocated on construction. */
+class Sixel_renderer {
+ public:
+  /// Write frames to the file descriptor \p fd.
+  explicit Sixel_renderer(std::size_t scale, int fd = STDOUT_FILENO)
+    : fd_{fd},
+      scale_{std::max<std::size_t>(scale, 1)},
+      bands_{(Framebuffer::height * scale_ + 5) / 6},
+      band_capacity_{2 * (2 + Framebuffer::width * scale_) + 1},
+      band_cache_(bands_ * band_capacity_),
+      band_sizes_(bands_, 0),
+      band_pending_(bands_, true),
+      output_(max_header_size + bands_ * (band_capacity_ + 1) + 2)
+  {}
+
+ public:
+  /// Return the terminal output that updates the last encoded frame to
+  /// \p screen, empty if nothing changed.
+  /** The view is valid until the next call. */
+  auto encode(Framebuffer const& screen) -> std::string_view
+  {
+    auto last_pending = std::optional<std::size_t>{};
+    for (auto band = std::size_t{0}; band < bands_; ++band) {
+      if (this->band_changed(screen, band)) {
+        this->encode_band(screen, band);
+        band_pending_[band] = true;
+      }
+      if (band_pending_[band]) {
+        last_pending = band;
       }
-      if (buffer[y_off + 1][x_off + 0]) {
-        base |= U'⠂';
+    }
+    previous_ = screen;
+    if (!last_pending) {
+      return {};
+    }
+    auto out = output_.data();
+    auto const append = [&out](std::string_view text) {
+      out = std::copy(text.begin(), text.end(), out);
+    };
+    auto const append_number = [&out, this](std::size_t n) {
+      out = std::to_chars(out, output_.data() + output_.size(), n).ptr;
+    };
+    // Home the cursor, start a Sixel image with a transparent background.
+    append("\x1b[1;1H\x1bP0;1;0q\"1;1;");
+    append_number(Framebuffer::width * scale_);
+    append(";");
+    append_number(Framebuffer::height * scale_);
+    append("#0;2;0;0;0#1;2;100;100;100");
+    for (auto band = std::size_t{0}; band <= *last_pending; ++band) {
+      if (band != 0) {
+        append("-");
       }
-      if (buffer[y_off + 2][x_off + 0]) {
-        base |= U'⠄';
+      if (std::exchange(band_pending_[band], false)) {
+        append({band_cache_.data() + band * band_capacity_, band_sizes_[band]});
+      }
+    }
+    append("\x1b\\");
+    return {output_.data(), std::size_t(out - output_.data())};
+  }
+
+  /// Write the bands of \p screen that changed since the last call.
+  auto present(Framebuffer const& screen) -> void
+  {
+    auto const output = this->encode(screen);
+    if (output.empty()) {
+      ++stats_.frames_skipped;
+      return;
+    }
+    if (!write_all(fd_, output, stats_)) {
+      // Unknown what made it out, send every band again from the cache.
+      std::ranges::fill(band_pending_, true);
+      return;
+    }
+    ++stats_.frames_presented;
+    stats_.bytes_written += output.size();
+    stats_.last_frame_bytes = output.size();
+  }
+
+  auto stats() const -> Render_stats const& { return stats_; }
+
+ private:
+  /// Cursor home, image start, raster attributes and two color registers.
+  static constexpr auto max_header_size = std::size_t{64};
+
+ private:
+  /// Return the framebuffer rows [first, last] drawn in \p band.
+  auto band_rows(std::size_t band) const -> std::pair<std::size_t, std::size_t>
+  {
+    auto const first = band * 6 / scale_;
+    auto const last  = (band * 6 + 5) / scale_;
+    return {first, std::min(last, Framebuffer::height - 1)};
+  }
+
+  auto band_changed(Framebuffer const& screen, std::size_t band) const -> bool
+  {
+    if (!previous_) {
+      return true;
+    }
+    auto const [first, last] = this->band_rows(band);
+    for (auto y = first; y <= last; ++y) {
+      if (screen.row(y) != previous_->row(y)) {
+        return true;
       }
-      if (buffer[y_off + 3][x_off + 0]) {
-        base |= U'⡀';
+    }
+    return false;
+  }
+
+  /// Encode \p band into its slot of band_cache_, as the unlit pixels in
+  /// color 0 then the lit pixels in color 1.
+  auto encode_band(Framebuffer const& screen, std::size_t band) -> void
+  {
+    // Sixel bits of each pixel column, bit k is image row band * 6 + k.
+    auto lit       = std::array<std::uint8_t, Framebuffer::width>{};
+    auto drawn     = std::uint8_t{0};  // Rows inside the image.
+    auto const top = band * 6;
+    for (auto k = std::size_t{0}; k < 6; ++k) {
+      auto const y = (top + k) / scale_;
+      if (y >= Framebuffer::height) {
+        break;
       }
-      if (buffer[y_off + 0][x_off + 1]) {
-        base |= U'⠈';
+      drawn |= std::uint8_t(1u << k);
+      for (auto x = std::size_t{0}; x < Framebuffer::width; ++x) {
+        lit[x] |= std::uint8_t(screen.pixel(x, y) << k);
       }
-      if (buffer[y_off + 1][x_off + 1]) {
-        base |= U'⠐';
+    }
+    auto const begin = band_cache_.data() + band * band_capacity_;
+    auto out         = begin;
+    auto passes      = 0;
+    for (auto const color : {0, 1}) {
+      auto runs = std::array<std::uint8_t, Framebuffer::width>{};
+      for (auto x = std::size_t{0}; x < Framebuffer::width; ++x) {
+        runs[x] = color == 1 ? lit[x] : std::uint8_t(drawn & ~lit[x]);
       }
-      if (buffer[y_off + 2][x_off + 1]) {
-        base |= U'⠠';
+      auto const end = std::find_if(runs.rbegin(), runs.rend(),
+                                    [](auto bits) { return bits != 0; });
+      auto const width = std::size_t(runs.rend() - end);
+      if (width == 0) {
+        continue;
       }
-      if (buffer[y_off + 3][x_off + 1]) {
-        base |= U'⢀';
+      if (passes++ != 0) {
+        *out++ = '$';
       }
-      esc::write(base);
+      *out++ = '#';
+      *out++ = char('0' + color);
+      out    = this->encode_pass(runs.data(), width, out);
     }
-    esc::write('\n');
+    band_sizes_[band] = std::size_t(out - begin);
   }
 
-#else
-  for (auto y = 0; y < 16; ++y) {
-    for (auto x = 0; x < 64; ++x) {
-      auto block = U' ';
-      if (buffer[y * 2][x] && buffer[(y * 2) + 1][x]) {
-        block = U'█';
+  /// Write the sixels of the first \p width pixel columns of \p bits, with
+  /// each column repeated scale_ times and long runs compressed.
+  auto encode_pass(std::uint8_t const* bits, std::size_t width, char* out) const
+    -> char*
+  {
+    for (auto x = std::size_t{0}; x < width;) {
+      auto run = x + 1;
+      while (run < width && bits[run] == bits[x]) {
+        ++run;
       }
-      else if (buffer[y * 2][x]) {
-        block = U'▀';
+      auto const count = (run - x) * scale_;
+      auto const sixel = char(63 + bits[x]);
+      if (count > 3) {
+        *out++ = '!';
+        out    = std::to_chars(out, out + 20, count).ptr;
+        *out++ = sixel;
       }
-      else if (buffer[(y * 2) + 1][x]) {
-        block = U'▄';
+      else {
+        out = std::fill_n(out, count, sixel);
       }
-      esc::write(block);
+      x = run;
     }
-    esc::write('\n');
+    return out;
   }
 
-#endif
-  esc::flush();
+ private:
+  int fd_;
+  std::size_t scale_;
+  std::size_t bands_;
+  std::size_t band_capacity_;
+  std::vector<char> band_cache_;  // band_capacity_ bytes per band.
+  std::vector<std::size_t> band_sizes_;
+  std::vector<char> band_pending_;  // Encoded but not yet sent.
+  std::vector<char> output_;
+  std::optional<Framebuffer> previous_;
+  Render_stats stats_;
+};
+
+/// Ways to draw the framebuffer to the terminal.
+enum class Render_mode { Half_block, Braille, Sextant, Sixel };
+
+/// Throws std::runtime_error if \p name is not a known renderer.
+inline auto parse_render_mode(std::string const& name) -> Render_mode
+{
+  if (name == "halfblock") {
+    return Render_mode::Half_block;
+  }
+  if (name == "braille") {
+    return Render_mode::Braille;
+  }
+  if (name == "sextant") {
+    return Render_mode::Sextant;
+  }
+  if (name == "sixel") {
+    return Render_mode::Sixel;
+  }
+  throw std::runtime_error{"Unknown --renderer: " + name +
+                           ", expected halfblock, braille, sextant or sixel."};
 }
 
+/// Renderer chosen at runtime, see Render_mode.
+class Renderer {
+ public:
+  /// Write frames drawn as \p mode to the file descriptor \p fd.
+  /** \p sixel_scale is the scale of Render_mode::Sixel. */
+  explicit Renderer(Render_mode mode        = Render_mode::Half_block,
+                    int fd                  = STDOUT_FILENO,
+                    std::size_t sixel_scale = default_sixel_scale)
+    : renderer_{make(mode, fd, sixel_scale)}
+  {}
+
+  static constexpr auto default_sixel_scale = std::size_t{4};
+
+ public:
+  /// See Cell_renderer::encode() and Sixel_renderer::encode().
+  auto encode(Framebuffer const& screen) -> std::string_view
+  {
+    return std::visit([&](auto& r) { return r.encode(screen); }, renderer_);
+  }
+
+  /// See Cell_renderer::present() and Sixel_renderer::present().
+  auto present(Framebuffer const& screen) -> void
+  {
+    std::visit([&](auto& r) { r.present(screen); }, renderer_);
+  }
+
+  auto stats() const -> Render_stats const&
+  {
+    return std::visit(
+      [](auto const& r) -> Render_stats const& { return r.stats(); },
+      renderer_);
+  }
+
+ private:
+  using Variant = std::variant<Cell_renderer<Half_block_cell>,
+                               Cell_renderer<Braille_cell>,
+                               Cell_renderer<Sextant_cell>,
+                               Sixel_renderer>;
+
+  static auto make(Render_mode mode, int fd, std::size_t sixel_scale)
+    -> Variant
+  {
+    switch (mode) {
+      case Render_mode::Braille:
+        return Variant{std::in_place_index<1>, fd};
+      case Render_mode::Sextant:
+        return Variant{std::in_place_index<2>, fd};
+      case Render_mode::Sixel:
+        return Variant{std::in_place_index<3>, sixel_scale, fd};
+      case Render_mode::Half_block:
+        break;
+    }
+    return Variant{std::in_place_index<0>, fd};
+  }
+
+ private:
+  Variant renderer_;
+};
+
 }  // namespace chip8
 #endif  // SCREEN_HPP
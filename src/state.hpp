@@ -5,7 +5,9 @@
 #include <optional>
 
 #include "constants.hpp"
+#include "framebuffer.hpp"
 #include "keyboard.hpp"
+#include "random.hpp"
 #include "types.hpp"
 
 namespace chip8 {
@@ -19,9 +21,15 @@ struct State {
   Timer_register delay_timer_register;
   Timer_register sound_timer_register;
   std::array<std::uint8_t, MEMORY_AMOUNT> memory{};
-  Keyboard<75> keyboard;
-  std::array<std::array<bool, 64>, 32> screen_buffer;
+  Keyboard keyboard;
+  Framebuffer screen_buffer;
+  Random_generator random_generator;
+  bool waiting_for_key  = false;  // Stopped on Fx0A, no key was held.
+  std::uint8_t sprite_x = 0;      // Vx of the last Dxyn when it drew.
 };
 
+/// Executes a single instruction and returns the next program counter address.
+using Handler_t = auto (*)(State&, Instruction_t) -> Address_t;
+
 }  // namespace chip8
 #endif  // CHIP8_STATE_HPP
@@ -0,0 +1,180 @@
+#ifndef THREAD_POOL_HPP
+#define THREAD_POOL_HPP
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace chip8 {
+
+/// Fixed size thread pool where idle workers steal queued tasks from others.
+/** Every worker owns a queue. Tasks submitted from a worker go to the back of
+ *  its own queue, other tasks are spread round robin. A worker takes tasks
+ *  from the front of its queue and, when that is empty, from the back of
+ *  another worker's queue. */
+class Work_stealing_pool {
+ public:
+  using Task = std::function<void()>;
+
+ public:
+  /// Start \p thread_count workers, at least one.
+  explicit Work_stealing_pool(
+    std::size_t thread_count = std::thread::hardware_concurrency())
+  {
+    thread_count = std::max<std::size_t>(thread_count, 1);
+    queues_.reserve(thread_count);
+    for (auto i = std::size_t{0}; i < thread_count; ++i) {
+      queues_.push_back(std::make_unique<Queue>());
+    }
+    threads_.reserve(thread_count);
+    for (auto i = std::size_t{0}; i < thread_count; ++i) {
+      threads_.emplace_back([this, i] { this->work(i); });
+    }
+  }
+
+  Work_stealing_pool(Work_stealing_pool const&)                    = delete;
+  auto operator=(Work_stealing_pool const&) -> Work_stealing_pool& = delete;
+
+  /// Stops the workers, tasks still queued are discarded. Call wait() first
+  /// to finish them.
+  ~Work_stealing_pool()
+  {
+    {
+      auto const lock = std::scoped_lock{sleep_mutex_};
+      stopping_       = true;
+    }
+    work_available_.notify_all();
+    for (auto& thread : threads_) {
+      thread.join();
+    }
+  }
+
+ public:
+  /// Queue \p task to run on one of the workers. Safe to call from a task.
+  auto submit(Task task) -> void
+  {
+    auto const index = current_pool_ == this
+                         ? current_worker_
+                         : next_queue_.fetch_add(1) % queues_.size();
+    ++pending_;
+    {
+      // Counted first so queued_ never falls below the tasks in the queues.
+      auto const lock = std::scoped_lock{sleep_mutex_};
+      ++queued_;
+    }
+    {
+      auto& queue     = *queues_[index];
+      auto const lock = std::scoped_lock{queue.mutex};
+      queue.tasks.push_back(std::move(task));
+    }
+    work_available_.notify_one();
+  }
+
+  /// Block until every submitted task, including tasks submitted by tasks,
+  /// has finished. Rethrows the first exception thrown by a task.
+  auto wait() -> void
+  {
+    auto lock = std::unique_lock{sleep_mutex_};
+    all_done_.wait(lock, [this] { return pending_ == 0; });
+    if (error_ != nullptr) {
+      std::rethrow_exception(std::exchange(error_, nullptr));
+    }
+  }
+
+  /// Number of worker threads.
+  auto size() const -> std::size_t { return threads_.size(); }
+
+ private:
+  struct Queue {
+    std::mutex mutex;
+    std::deque<Task> tasks;
+  };
+
+ private:
+  auto work(std::size_t index) -> void
+  {
+    current_pool_   = this;
+    current_worker_ = index;
+    while (true) {
+      {
+        auto lock = std::unique_lock{sleep_mutex_};
+        work_available_.wait(lock,
+                             [this] { return stopping_ || queued_ > 0; });
+        if (stopping_) {
+          return;
+        }
+      }
+      auto task = this->take(index);
+      if (!task) {
+        continue;  // Another worker got there first.
+      }
+      try {
+        task();
+      }
+      catch (...) {
+        auto const lock = std::scoped_lock{sleep_mutex_};
+        if (error_ == nullptr) {
+          error_ = std::current_exception();
+        }
+      }
+      if (--pending_ == 0) {
+        auto const lock = std::scoped_lock{sleep_mutex_};
+        all_done_.notify_all();
+      }
+    }
+  }
+
+  /// Pop from the front of queue \p index, or steal from the back of another.
+  auto take(std::size_t index) -> Task
+  {
+    auto task = Task{};
+    for (auto i = std::size_t{0}; i < queues_.size() && !task; ++i) {
+      auto& queue     = *queues_[(index + i) % queues_.size()];
+      auto const lock = std::scoped_lock{queue.mutex};
+      if (queue.tasks.empty()) {
+        continue;
+      }
+      if (i == 0) {
+        task = std::move(queue.tasks.front());
+        queue.tasks.pop_front();
+      }
+      else {
+        task = std::move(queue.tasks.back());
+        queue.tasks.pop_back();
+      }
+    }
+    if (task) {
+      auto const lock = std::scoped_lock{sleep_mutex_};
+      --queued_;
+    }
+    return task;
+  }
+
+ private:
+  std::vector<std::unique_ptr<Queue>> queues_;
+  std::vector<std::thread> threads_;
+  std::atomic<std::size_t> next_queue_ = 0;
+  std::atomic<std::size_t> pending_    = 0;  // Submitted and not finished.
+
+  // Guards the members below.
+  std::mutex sleep_mutex_;
+  std::condition_variable work_available_;
+  std::condition_variable all_done_;
+  std::size_t queued_ = 0;  // Tasks sitting in a queue.
+  bool stopping_      = false;
+  std::exception_ptr error_;
+
+  inline static thread_local Work_stealing_pool const* current_pool_ = nullptr;
+  inline static thread_local std::size_t current_worker_             = 0;
+};
+
+}  // namespace chip8
+#endif  // THREAD_POOL_HPP
@@ -0,0 +1,203 @@
+#ifndef THREADED_HPP
+#define THREADED_HPP
+#ifdef CHIP8_THREADED
+#  if !defined(__GNUC__)
+#    error "CHIP8_THREADED requires the GCC/Clang labels-as-values extension."
+#  endif
+#  include <cstddef>
+#  include <cstdint>
+
+#  include "constants.hpp"
+#  include "instructions.hpp"
+#  include "state.hpp"
+#  include "types.hpp"
+
+namespace chip8 {
+
+/// Direct-threaded interpreter built on computed goto.
+/** Each operation fetches the next instruction and jumps straight to its
+ *  operation, so a call to run() executes a whole slice of instructions
+ *  without returning to the caller. A slice ends after slice_length
+ *  instructions, after an instruction that changes the display or after Fx0A,
+ *  so timers and graphics are only serviced at those boundaries. */
+class Threaded_interpreter {
+ public:
+  explicit Threaded_interpreter(std::size_t slice_length = 64)
+    : slice_length_{slice_length}
+  {}
+
+ public:
+  /// Execute one slice, calling \p on_executed with each instruction word
+  /// after it has run. Returns false without executing anything if the
+  /// program counter points to an invalid address.
+  template <typename Fn>
+  auto run(State& state, Fn&& on_executed) -> bool
+  {
+    static void* const operations[16] = {
+      &&op_0, &&op_1, &&op_2, &&op_3, &&op_4, &&op_5, &&op_6, &&op_7,
+      &&op_8, &&op_9, &&op_A, &&op_B, &&op_C, &&op_D, &&op_E, &&op_F,
+    };
+    static void* const alu_operations[16] = {
+      &&alu_0, &&alu_1, &&alu_2, &&alu_3, &&alu_4, &&alu_5, &&alu_6, &&alu_7,
+      &&next,  &&next,  &&next,  &&next,  &&next,  &&next,  &&alu_E, &&next,
+    };
+
+    auto& pc               = state.program_counter;
+    auto instruction       = Instruction_t{0};
+    auto remaining         = slice_length_;
+    auto const fetch_limit = MEMORY_AMOUNT - 1;
+
+    if (pc >= fetch_limit) {
+      return false;
+    }
+
+// Report the current instruction, then fetch and jump to the next one unless
+// the slice is over.
+#  define CHIP8_DISPATCH()                                \
+    on_executed(instruction);                             \
+    if (--remaining == 0 || pc >= fetch_limit) {          \
+      return true;                                        \
+    }                                                     \
+    instruction = Instruction_t((state.memory[pc] << 8) | \
+                                state.memory[pc + 1]);    \
+    goto *operations[opcode(instruction)]
+// Advance past the current instruction and dispatch the next.
+#  define CHIP8_NEXT() \
+    pc += 2;           \
+    CHIP8_DISPATCH()
+// Report the current instruction and end the slice.
+#  define CHIP8_END_SLICE()   \
+    on_executed(instruction); \
+    return true
+
+    instruction =
+      Instruction_t((state.memory[pc] << 8) | state.memory[pc + 1]);
+    goto *operations[opcode(instruction)];
+
+  next:
+    CHIP8_NEXT();
+
+  op_0:
+    if (instruction == 0x00E0) {
+      clear_display(state);
+      pc += 2;
+      CHIP8_END_SLICE();
+    }
+    if (instruction == 0x00EE) {
+      subroutine_return(state);
+    }
+    CHIP8_NEXT();
+  op_1:
+    jump_to_address(state, instruction);
+    CHIP8_DISPATCH();
+  op_2:
+    call_subroutine(state, instruction);
+    CHIP8_DISPATCH();
+  op_3:
+    skip_if_equal_rb(state, instruction);
+    CHIP8_NEXT();
+  op_4:
+    skip_if_not_equal_rb(state, instruction);
+    CHIP8_NEXT();
+  op_5:
+    if (n(instruction) != 0) {
+      throw unknown_instruction_exception(instruction);
+    }
+    skip_if_equal_rr(state, instruction);
+    CHIP8_NEXT();
+  op_6:
+    set_register(state, instruction);
+    CHIP8_NEXT();
+  op_7:
+    add_register(state, instruction);
+    CHIP8_NEXT();
+  op_8:
+    goto *alu_operations[n(instruction)];
+  alu_0:
+    load_y_to_x(state, instruction);
+    CHIP8_NEXT();
+  alu_1:
+    bitwise_or(state, instruction);
+    CHIP8_NEXT();
+  alu_2:
+    bitwise_and(state, instruction);
+    CHIP8_NEXT();
+  alu_3:
+    bitwise_xor(state, instruction);
+    CHIP8_NEXT();
+  alu_4:
+    add_with_carry(state, instruction);
+    CHIP8_NEXT();
+  alu_5:
+    subtract_with_not_borrow(state, instruction);
+    CHIP8_NEXT();
+  alu_6:
+    shift_right(state, instruction);
+    CHIP8_NEXT();
+  alu_7:
+    rsubtract_with_not_borrow(state, instruction);
+    CHIP8_NEXT();
+  alu_E:
+    shift_left(state, instruction);
+    CHIP8_NEXT();
+  op_9:
+    if (n(instruction) != 0) {
+      throw unknown_instruction_exception(instruction);
+    }
+    skip_if_not_equal_rr(state, instruction);
+    CHIP8_NEXT();
+  op_A:
+    set_index_register(state, instruction);
+    CHIP8_NEXT();
+  op_B:
+    jump_to_nnn_plus_v0(state, instruction);
+    CHIP8_DISPATCH();
+  op_C:
+    random_byte(state, instruction);
+    CHIP8_NEXT();
+  op_D:
+    display_sprite(state, instruction);
+    pc += 2;
+    CHIP8_END_SLICE();
+  op_E:
+    switch (kk(instruction)) {
+      case 0x9E: skip_if_pressed(state, instruction); break;
+      case 0xA1: skip_if_not_pressed(state, instruction); break;
+      default: throw unknown_instruction_exception(instruction);
+    }
+    CHIP8_NEXT();
+  op_F:
+    switch (kk(instruction)) {
+      case 0x07: set_from_delay_timer(state, instruction); break;
+      case 0x0A:
+        wait_for_keypress(state, instruction);
+        CHIP8_END_SLICE();
+      case 0x15: set_delay_timer(state, instruction); break;
+      case 0x18: set_sound_timer(state, instruction); break;
+      case 0x1E: add_to_index_register(state, instruction); break;
+      case 0x29:
+        set_index_register_to_digit_sprite(state, instruction);
+        break;
+      case 0x33: store_bcd_representation(state, instruction); break;
+      case 0x55: registers_to_memory(state, instruction); break;
+      case 0x65: memory_to_registers(state, instruction); break;
+      default: throw unknown_instruction_exception(instruction);
+    }
+    CHIP8_NEXT();
+
+#  undef CHIP8_DISPATCH
+#  undef CHIP8_NEXT
+#  undef CHIP8_END_SLICE
+  }
+
+  /// Nothing is cached, instructions are fetched from State::memory as they
+  /// run.
+  auto clear() -> void {}
+
+ private:
+  std::size_t slice_length_;
+};
+
+}  // namespace chip8
+#endif  // CHIP8_THREADED
+#endif  // THREADED_HPP
@@ -3,14 +3,39 @@
 #include <algorithm>
 #include <chrono>
 #include <cstdint>
+#include <stdexcept>
+#include <string>
 
 #include "types.hpp"
 
 namespace chip8 {
 
+/// How the delay and sound timers count down in an interactive run.
+enum class Timer_mode {
+  Cycle,       // Once per 60Hz frame of emulated time, see tick_timer().
+  Wall_clock,  // Following the host clock, see update_timer().
+};
+
+/// Throws std::runtime_error if \p name is not a known mode.
+inline auto parse_timer_mode(std::string const& name) -> Timer_mode
+{
+  if (name == "cycle") {
+    return Timer_mode::Cycle;
+  }
+  if (name == "wallclock") {
+    return Timer_mode::Wall_clock;
+  }
+  throw std::runtime_error{"Unknown --timers: " + name +
+                           ", expected cycle or wallclock."};
+}
+
+/// Count down \p reg by the 60Hz ticks of host time since the last update.
+/** A stopped timer only follows the clock, so a value written later counts
+ *  down from the update before the write. */
 inline auto update_timer(Timer_register& reg) -> void
 {
   if (reg.value == 0) {
+    reg.previous_update = Clock_t::now();
     return;
   }
   auto const elapsed = Clock_t::now() - reg.previous_update;
@@ -21,5 +46,13 @@ inline auto update_timer(Timer_register& reg) -> void
   }
 }
 
+/// Count down a single 60Hz tick, for runs not paced by the host clock.
+inline auto tick_timer(Timer_register& reg) -> void
+{
+  if (reg.value != 0) {
+    --reg.value;
+  }
+}
+
 }  // namespace chip8
 #endif  // TIMER_HPP
@@ -0,0 +1,56 @@
+#ifndef TRIPLE_BUFFER_HPP
+#define TRIPLE_BUFFER_HPP
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+namespace chip8 {
+
+/// Lock-free handoff of the latest value from one writer thread to one reader
+/// thread.
+/** The writer fills its own buffer and publishes it by swapping it with the
+ *  middle buffer, the reader takes the middle buffer by swapping it with its
+ *  own. Neither side ever waits for the other, a value published before the
+ *  reader took the previous one replaces it and is dropped. */
+template <typename T>
+class Triple_buffer {
+ public:
+  /// Buffer the writer fills before calling publish().
+  auto write_buffer() -> T& { return buffers_[back_]; }
+
+  /// Make the write buffer the latest value. Returns false if the previous
+  /// value was never read, it is dropped.
+  auto publish() -> bool
+  {
+    auto const old = middle_.exchange(back_ | fresh, std::memory_order_acq_rel);
+    back_          = old & index_mask;
+    return (old & fresh) == 0;
+  }
+
+  /// Take the latest published value if it is newer than read_buffer().
+  /** Returns false if nothing was published since the last call. */
+  auto update() -> bool
+  {
+    if ((middle_.load(std::memory_order_relaxed) & fresh) == 0) {
+      return false;
+    }
+    front_ = middle_.exchange(front_, std::memory_order_acq_rel) & index_mask;
+    return true;
+  }
+
+  /// The value taken by the last successful update().
+  auto read_buffer() const -> T const& { return buffers_[front_]; }
+
+ private:
+  static constexpr auto index_mask = std::uint8_t{0b011};
+  static constexpr auto fresh      = std::uint8_t{0b100};
+
+ private:
+  std::array<T, 3> buffers_{};
+  std::atomic<std::uint8_t> middle_ = 1;
+  std::uint8_t back_                = 0;  // Owned by the writer.
+  std::uint8_t front_               = 2;  // Owned by the reader.
+};
+
+}  // namespace chip8
+#endif  // TRIPLE_BUFFER_HPP
@@ -1,11 +1,49 @@
 #include <array>
+#include <atomic>
 #include <cassert>
+#include <chrono>
 #include <cstdint>
+#include <filesystem>
 #include <iostream>
+#include <optional>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
 
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "../src/backend.hpp"
+#include "../src/batch.hpp"
+#include "../src/block_cache.hpp"
+#include "../src/clock.hpp"
 #include "../src/debug.hpp"
+#include "../src/decode_cache.hpp"
+#include "../src/framebuffer.hpp"
+#include "../src/headless.hpp"
+#include "../src/idle.hpp"
+#include "../src/initialize.hpp"
+#include "../src/input_thread.hpp"
 #include "../src/instructions.hpp"
+#include "../src/jit.hpp"
+#include "../src/keyboard.hpp"
+#include "../src/lockstep.hpp"
+#include "../src/movie.hpp"
+#include "../src/present.hpp"
+#include "../src/random.hpp"
+#include "../src/render_thread.hpp"
+#include "../src/rewind.hpp"
+#include "../src/save_state.hpp"
+#include "../src/scheduler.hpp"
+#include "../src/screen.hpp"
 #include "../src/state.hpp"
+#include "../src/thread_pool.hpp"
+#include "../src/threaded.hpp"
+#include "../src/timer.hpp"
+#include "../src/triple_buffer.hpp"
 #include "../src/types.hpp"
 
 using namespace esc;
@@ -278,6 +316,15 @@ auto test09() -> void
     process_instruction(state, 0xC500);
     test_equal((int)reg[0x5], 0x0);
   }
+  {
+    // Unseeded machines draw the same numbers.
+    auto a = State{};
+    auto b = State{};
+    process_instruction(a, 0xC5FF);
+    process_instruction(b, 0xC5FF);
+    test_equal(a.general_purpose_registers[0x5],
+               b.general_purpose_registers[0x5]);
+  }
 }
 
 // Dxyn - DRW Vx, Vy, nibble
@@ -316,7 +363,7 @@ auto test10() -> void
       for (auto j = 0; j < 8; j++) {
         auto const screen_x = reg[0x5] + j;
         auto const screen_y = reg[0x6] + i;
-        test_equal(state.screen_buffer[screen_y][screen_x],
+        test_equal(state.screen_buffer.pixel(screen_x, screen_y),
                    (bool)(sprite[i] & (0x1 << (7 - j))));
       }
     }
@@ -324,10 +371,8 @@ auto test10() -> void
 
     // XOR and Collision
     process_instruction(state, 0xD560 + sprite_bytes);
-    for (auto const& row : state.screen_buffer) {
-      for (bool const pixel : row) {
-        test_equal(pixel, false);
-      }
+    for (auto const row : state.screen_buffer.rows()) {
+      test_equal(row, Framebuffer::Row_t{0});
     }
     test_equal((int)reg[0xF], 0x1);
 
@@ -339,12 +384,1288 @@ auto test10() -> void
     for (auto j = 0; j < 8; j++) {
       auto const screen_x = (reg[0x5] + j) % 64;
       auto const screen_y = reg[0x6] % 32;
-      test_equal(state.screen_buffer[screen_y][screen_x], true);
+      test_equal(state.screen_buffer.pixel(screen_x, screen_y), true);
     }
     test_equal((int)reg[0xF], 0x0);
   }
 }
 
+/// Run \p program on \p backend until the program counter is invalid.
+template <typename Backend_t>
+auto run_until_halt(std::vector<char> const& program) -> State
+{
+  auto state   = initialize_state(program);
+  auto backend = Backend_t{};
+  while (backend.run(state, [](Instruction_t) {})) {}
+  return state;
+}
+
+auto test_equal_state(State const& a, State const& b) -> void
+{
+  test_equal(a.general_purpose_registers == b.general_purpose_registers, true);
+  test_equal((int)a.index_register, (int)b.index_register);
+  test_equal((int)a.program_counter, (int)b.program_counter);
+  test_equal(a.instruction_stack == b.instruction_stack, true);
+  test_equal((int)a.stack_pointer, (int)b.stack_pointer);
+  test_equal(a.memory == b.memory, true);
+  test_equal(a.screen_buffer == b.screen_buffer, true);
+}
+
+// Fx55 overwrites an instruction that has already been cached, the second pass
+// must execute the new instruction.
+auto const test11_program = std::vector<char>{
+  0x62, 0x05,        // 200: LD V2, 0x05   (rewritten to LD V2, 0x07)
+  0x33, 0x01,        // 202: SE V3, 0x01
+  0x12, 0x08,        // 204: JP 0x208
+  0x1F, (char)0xFF,  // 206: JP 0xFFF      (halt)
+  0x63, 0x01,        // 208: LD V3, 0x01
+  0x60, 0x62,        // 20A: LD V0, 0x62
+  0x61, 0x07,        // 20C: LD V1, 0x07
+  (char)0xA2, 0x00,  // 20E: LD I, 0x200
+  (char)0xF1, 0x55,  // 210: LD [I], V1
+  0x12, 0x00,        // 212: JP 0x200
+};
+
+/// Rewrites cached even aligned code with an Fx55 run from an odd address.
+auto const test11_odd_program = [] {
+  auto program = std::vector<char>(0x2B, 0x00);
+  auto const emit = [&](Address_t address, Instruction_t instruction) {
+    program[address - INSTRUCTION_OFFSET]     = char(instruction >> 8);
+    program[address - INSTRUCTION_OFFSET + 1] = char(instruction & 0xFF);
+  };
+  emit(0x200, 0x7A01);  // ADD VA, 0x01
+  emit(0x202, 0x1210);  // JP 0x210
+  emit(0x210, 0x6201);  // LD V2, 0x01    (rewritten to LD V2, 0x07)
+  emit(0x212, 0x3A02);  // SE VA, 0x02
+  emit(0x214, 0x1221);  // JP 0x221
+  emit(0x216, 0x1FFF);  // JP 0xFFF       (halt)
+  emit(0x221, 0x6062);  // LD V0, 0x62
+  emit(0x223, 0x6107);  // LD V1, 0x07
+  emit(0x225, 0xA210);  // LD I, 0x210
+  emit(0x227, 0xF155);  // LD [I], V1
+  emit(0x229, 0x1200);  // JP 0x200
+  return program;
+}();
+
+// Decode_cache and Block_cache - self-modifying code
+auto test11() -> void
+{
+  auto const& program = test11_program;
+  auto const expected = run_until_halt<Interpreter>(program);
+  test_equal((int)expected.general_purpose_registers[0x2], 0x07);
+  test_equal_state(run_until_halt<Decode_cache>(program), expected);
+  test_equal_state(run_until_halt<Block_cache>(program), expected);
+
+  auto const odd = run_until_halt<Interpreter>(test11_odd_program);
+  test_equal((int)odd.general_purpose_registers[0x2], 0x07);
+  test_equal_state(run_until_halt<Decode_cache>(test11_odd_program), odd);
+  test_equal_state(run_until_halt<Block_cache>(test11_odd_program), odd);
+}
+
+auto const test12_program = std::vector<char>{
+  0x6A, 0x0C,              // 200: LD VA, 0x0C
+  0x22, 0x10,              // 202: CALL 0x210
+  0x7A, 0x01,              // 204: ADD VA, 0x01
+  0x4A, 0x10,              // 206: SNE VA, 0x10
+  0x1F, (char)0xFF,        // 208: JP 0xFFF      (halt)
+  0x12, 0x02,              // 20A: JP 0x202
+  0x00, 0x00,              // 20C:
+  0x00, 0x00,              // 20E:
+  (char)0x8B, (char)0xA4,  // 210: ADD VB, VA
+  (char)0xA2, 0x20,        // 212: LD I, 0x220
+  (char)0xFB, 0x33,        // 214: LD B, VB
+  (char)0xF2, 0x65,        // 216: LD V2, [I]
+  (char)0xD0, 0x13,        // 218: DRW V0, V1, 3
+  0x00, (char)0xEE,        // 21A: RET
+};
+
+// Block_cache - calls, skips and BCD writes
+auto test12() -> void
+{
+  auto const& program = test12_program;
+  auto const expected = run_until_halt<Interpreter>(program);
+  test_equal((int)expected.general_purpose_registers[0xB], 54);
+  test_equal_state(run_until_halt<Decode_cache>(program), expected);
+  test_equal_state(run_until_halt<Block_cache>(program), expected);
+}
+
+#if defined(CHIP8_JIT) || defined(CHIP8_THREADED)
+/// Every 8xyN with VF as an operand, mixed with handler calls, in a loop.
+auto alu_program() -> std::vector<char>
+{
+  auto program = std::vector<char>{};
+  auto emit    = [&](Instruction_t instruction) {
+    program.push_back((char)(instruction >> 8));
+    program.push_back((char)(instruction & 0xFF));
+  };
+  for (auto v = 0; v < 16; ++v) {
+    emit(0x6000 | (v << 8) | (v * 37 + 11) % 256);
+  }
+  auto const loop = Instruction_t(INSTRUCTION_OFFSET + program.size());
+  for (auto n : {0x0, 0x1, 0x2, 0x3, 0x4, 0x5, 0x6, 0x7, 0xE}) {
+    for (auto [vx, vy] : {std::pair{1, 2}, {2, 1}, {0xF, 3}, {3, 0xF}, {4, 4},
+                          {0xF, 0xF}}) {
+      emit(0x8000 | (vx << 8) | (vy << 4) | n);
+      // Fold VF into VE so every flag result is observed.
+      emit(0x8DF3);
+      emit(0x8ED4);
+    }
+    emit(0x7517);
+    emit(0xA300);
+    emit(0xF31E);
+    emit(0xD125);
+  }
+  emit(0xA400);
+  emit(0xF233);
+  emit(0xF265);
+  emit(0x3105);
+  emit(0x1000 | loop);
+  emit(0x1000 | loop);
+  return program;
+}
+
+/// Run \p program on \p backend for at least \p count instructions and check
+/// the result against process_instruction after the same instructions.
+template <typename Backend_t>
+auto test_matches_interpreter(std::vector<char> const& program, int count)
+  -> void
+{
+  auto state    = initialize_state(program);
+  auto backend  = Backend_t{};
+  auto executed = 0;
+  while (executed < count &&
+         backend.run(state, [&](Instruction_t) { ++executed; })) {}
+
+  auto expected = initialize_state(program);
+  for (auto i = 0; i < executed; ++i) {
+    expected.program_counter =
+      process_instruction(expected, *get_instruction(expected));
+  }
+  test_equal_state(state, expected);
+}
+#endif
+
+#ifdef CHIP8_JIT
+// Jit - compiled blocks match the interpreter
+auto test13() -> void
+{
+  test_equal_state(run_until_halt<Jit>(test11_program),
+                   run_until_halt<Interpreter>(test11_program));
+  test_equal_state(run_until_halt<Jit>(test12_program),
+                   run_until_halt<Interpreter>(test12_program));
+  test_matches_interpreter<Jit>(alu_program(), 20000);
+}
+#endif
+
+// dispatch_table - every encoding matches process_instruction_switch
+auto test14() -> void
+{
+  auto base  = initialize_state({});
+  auto value = 0x2545F491u;
+  auto next  = [&] { return value = value * 1103515245u + 12345u; };
+  for (auto& r : base.general_purpose_registers) {
+    r = next() >> 16;
+  }
+  for (auto& byte : base.memory) {
+    byte = next() >> 16;
+  }
+  for (auto& address : base.instruction_stack) {
+    address = (next() >> 16) & 0xFFF;
+  }
+  base.stack_pointer   = 7;
+  base.index_register  = 0x345;
+  base.program_counter = 0x456;
+
+  for (auto i = 0; i <= 0xFFFF; ++i) {
+    auto const instruction = Instruction_t(i);
+    auto table        = base;
+    auto reference    = base;
+    auto table_pc     = std::optional<Address_t>{};
+    auto reference_pc = std::optional<Address_t>{};
+    try {
+      table_pc = process_instruction(table, instruction);
+    }
+    catch (std::runtime_error const&) {
+    }
+    try {
+      reference_pc = process_instruction_switch(reference, instruction);
+    }
+    catch (std::runtime_error const&) {
+    }
+    if ((instruction & 0xF000) == 0xC000) {
+      // Random byte, only the register written differs.
+      table.general_purpose_registers[(instruction & 0x0F00) >> 8] = 0;
+      reference.general_purpose_registers[(instruction & 0x0F00) >> 8] = 0;
+    }
+    test_equal(table_pc == reference_pc, true);
+    test_equal_state(table, reference);
+  }
+}
+
+#ifdef CHIP8_THREADED
+// Threaded_interpreter - slices match the interpreter
+auto test15() -> void
+{
+  test_equal_state(run_until_halt<Threaded_interpreter>(test11_program),
+                   run_until_halt<Interpreter>(test11_program));
+  test_equal_state(run_until_halt<Threaded_interpreter>(test12_program),
+                   run_until_halt<Interpreter>(test12_program));
+  test_matches_interpreter<Threaded_interpreter>(alu_program(), 20000);
+}
+#endif
+
+// Headless runs
+// ADD V1, 1; ADD V2, 1; LD V3, K; JP 0x200
+template <typename Backend_t>
+auto test16_backend(Backend_t backend) -> void
+{
+  auto state = initialize_state(
+    {0x71, 0x01, 0x72, 0x01, (char)0xF3, 0x0A, 0x12, 0x00});
+  auto keys   = std::atomic<Key_mask>{1};
+  auto report = Headless_report{};
+  state.keyboard.attach(keys);
+  // Loop with a key held, long enough for the Jit to compile the loop.
+  while (report.instructions < 40) {
+    backend.run(state, [&](Instruction_t) { ++report.instructions; });
+  }
+  // Detached, LD V3, K throws after the two ADDs of its block have run.
+  test_equal(resume_headless(state, backend, report, 1000, 8), false);
+  test_equal(report.halt_reason, std::string{"waiting for a keypress"});
+  auto const& reg = state.general_purpose_registers;
+  test_equal(reg[2], reg[1]);
+  test_equal(report.instructions, std::uint64_t{4u * reg[1] - 2});
+}
+
+auto test16() -> void
+{
+  {
+    // LD V0, 0xA; LD DT, V0; LD F, V0; DRW V0, V0, 5; LD V0, K
+    auto state = initialize_state(
+      {0x60, 0x0A, (char)0xF0, 0x15, (char)0xF0, 0x29, (char)0xD0, 0x05,
+       (char)0xF0, 0x0A});
+    auto const blank  = framebuffer_hash(state);
+    auto backend      = Interpreter{};
+    auto const report = run_headless(state, backend, 1000, 1);
+    test_equal(report.halt_reason, std::string{"waiting for a keypress"});
+    test_equal(report.instructions, std::uint64_t{4});
+    test_equal(report.frames, std::uint64_t{4});
+    test_equal((int)state.delay_timer_register.value, 0x7);
+    test_equal((int)state.program_counter, 0x208);
+    test_not_equal(framebuffer_hash(state), blank);
+
+    auto expected                         = initialize_state({});
+    expected.general_purpose_registers[0] = 0xA;
+    set_index_register_to_digit_sprite(expected, 0xF029);
+    display_sprite(expected, 0xD005);
+    test_equal(framebuffer_hash(state), framebuffer_hash(expected));
+  }
+  {
+    // JP 0x200
+    auto state        = initialize_state({0x12, 0x00});
+    auto backend      = Decode_cache{};
+    auto const report = run_headless(state, backend, 100, 10);
+    test_equal(report.halt_reason, std::string{});
+    test_equal(report.instructions, std::uint64_t{100});
+    test_equal(report.frames, std::uint64_t{10});
+  }
+
+  // Instructions before one that throws are counted.
+  test16_backend(Interpreter{});
+  test16_backend(Decode_cache{});
+  test16_backend(Block_cache{});
+#ifdef CHIP8_JIT
+  test16_backend(Jit{});
+#endif
+#ifdef CHIP8_THREADED
+  test16_backend(Threaded_interpreter{});
+#endif
+}
+
+// Work stealing pool and batch runs
+auto batch_job(std::string name,
+               std::vector<char> program,
+               std::optional<std::uint64_t> seed = std::nullopt) -> Batch_job
+{
+  auto job    = Batch_job{};
+  job.name    = std::move(name);
+  job.program = std::move(program);
+  job.seed    = seed;
+  return job;
+}
+
+auto test17() -> void
+{
+  {
+    // Tasks that submit more tasks, all finished by wait().
+    auto count = std::atomic<int>{0};
+    auto pool  = Work_stealing_pool{4};
+    for (auto i = 0; i < 100; ++i) {
+      pool.submit([&] {
+        for (auto j = 0; j < 10; ++j) {
+          pool.submit([&] { ++count; });
+        }
+      });
+    }
+    pool.wait();
+    test_equal(count.load(), 1000);
+  }
+  {
+    auto pool = Work_stealing_pool{2};
+    pool.submit([] { throw std::runtime_error{"task"}; });
+    auto thrown = false;
+    try {
+      pool.wait();
+    }
+    catch (std::runtime_error const&) {
+      thrown = true;
+    }
+    test_equal(thrown, true);
+  }
+  {
+    auto const loop     = std::vector<char>{0x12, 0x00};  // JP 0x200
+    auto const oversize = std::vector<char>(MEMORY_AMOUNT, 0);
+    auto const jobs     = std::vector<Batch_job>{
+      batch_job("test11", test11_program),
+      batch_job("test12", test12_program),
+      batch_job("loop", loop),
+      batch_job("oversize", oversize),
+    };
+    auto const options = Batch_options{1000, 8, 7, 3, std::nullopt};
+    auto const results =
+      run_batch(jobs, options, [] { return Decode_cache{}; });
+    test_equal(results.size(), jobs.size());
+    for (auto i = std::size_t{0}; i < 3; ++i) {
+      auto state        = initialize_state(jobs[i].program);
+      auto backend      = Interpreter{};
+      auto const report = run_headless(state, backend, 1000, 8);
+      test_equal(results[i].name, jobs[i].name);
+      test_equal(results[i].report.instructions, report.instructions);
+      test_equal(results[i].report.frames, report.frames);
+      test_equal(results[i].report.halt_reason, report.halt_reason);
+      test_equal(results[i].framebuffer_hash, framebuffer_hash(state));
+    }
+    test_equal(results[2].report.instructions, std::uint64_t{1000});
+    test_not_equal(results[3].report.halt_reason, std::string{});
+  }
+}
+
+// Lockstep batches match independent headless runs
+auto test18() -> void
+{
+  auto const check = [](std::vector<char> const& program, auto&& setup) {
+    auto batch = Lockstep_batch<64>{program};
+    for (auto lane = std::size_t{0}; lane < 64; ++lane) {
+      auto state = batch.state(lane);
+      setup(lane, state);
+      batch.set_state(lane, state);
+    }
+    // Run in two parts to check runs resume where they stopped.
+    batch.run(300, 7);
+    batch.run(1000, 7);
+    for (auto lane = std::size_t{0}; lane < 64; ++lane) {
+      auto expected = initialize_state(program);
+      setup(lane, expected);
+      auto backend      = Interpreter{};
+      auto const report = run_headless(expected, backend, 1000, 7);
+      auto const actual = batch.state(lane);
+      test_equal_state(actual, expected);
+      test_equal((int)actual.delay_timer_register.value,
+                 (int)expected.delay_timer_register.value);
+      test_equal(batch.report(lane).instructions, report.instructions);
+      test_equal(batch.report(lane).frames, report.frames);
+      test_equal(batch.report(lane).halt_reason, report.halt_reason);
+    }
+  };
+  auto const same = [](std::size_t, State&) {};
+  check(test11_program, same);
+  check(test12_program, same);
+
+  // Lanes diverge on their starting registers, a few of them early on.
+  auto const diverge = [](std::size_t lane, State& state) {
+    for (auto r = 0; r < 15; ++r) {
+      state.general_purpose_registers[r] = std::uint8_t(lane * (r + 3) % 7);
+    }
+  };
+  // 200: LD DT, V1; ADD V0, V2; SE V0, 0; JP 0x202; ADD V3, V4; SHR V3;
+  // 20C: SUB V5, V3; ADD I, V5; LD V6, DT; SNE V6, V1; LD V7, K; JP 0x200
+  auto const loop = std::vector<char>{
+    (char)0xF1, 0x15, (char)0x80, 0x24, 0x30, 0x00, 0x12, 0x02,
+    (char)0x83, 0x44, (char)0x83, 0x36, (char)0x85, 0x35, (char)0xF5, 0x1E,
+    (char)0xF6, 0x07, (char)0x96, 0x10, (char)0xF7, 0x0A, 0x12, 0x00};
+  check(loop, diverge);
+  check(test12_program, diverge);
+}
+
+// Packed framebuffer
+auto test19() -> void
+{
+  auto screen = Framebuffer{};
+  test_equal(screen.draw_row(3, 0, 0b1000'0001), false);
+  test_equal(screen.row(3), Framebuffer::Row_t{0x8100'0000'0000'0000});
+  test_equal(screen.pixel(0, 3), true);
+  test_equal(screen.pixel(7, 3), true);
+  test_equal(screen.pixel(1, 3), false);
+
+  // Columns past the right edge wrap to the left.
+  test_equal(screen.draw_row(4, 60, 0b1111'0011), false);
+  test_equal(screen.row(4), Framebuffer::Row_t{0x3000'0000'0000'000F});
+  test_equal(screen.draw_row(4, 62, 0b0010'0000), false);
+  test_equal(screen.draw_row(4, 62, 0b0010'0000), true);
+  test_equal(screen.draw_row(4, 59, 0b0000'0001), true);
+  test_equal(screen.row(4), Framebuffer::Row_t{0x1000'0000'0000'000F});
+
+  screen.clear();
+  test_equal(screen == Framebuffer{}, true);
+
+  // The hash is defined on the pixels, it must not change with the layout.
+  auto state = initialize_state({});
+  test_equal(framebuffer_hash(state), std::uint64_t{0xd80ac658736bb725});
+  state.general_purpose_registers[0] = 62;
+  state.general_purpose_registers[1] = 30;
+  state.index_register               = digit_sprite_location(0xF);
+  display_sprite(state, 0xD015);
+  test_equal(framebuffer_hash(state), std::uint64_t{0x63d7b15bc0b4373f});
+  test_equal((int)state.general_purpose_registers[0xF], 0);
+}
+
+// Renderer only writes changed cells
+auto test20() -> void
+{
+  auto renderer = Renderer{};
+  auto screen   = Framebuffer{};
+  test_equal(renderer.encode(screen).size(),
+             std::size_t{16 * 64 + 9 * 6 + 7 * 7});
+  test_equal(renderer.encode(screen), std::string_view{});
+
+  // Distant cells are reached with a cursor move, close ones by rewriting the
+  // cells in between.
+  screen.draw_row(2, 10, 0b1000'0001);
+  test_equal(renderer.encode(screen),
+             std::string_view{"\x1b[2;11H\u2580\x1b[2;18H\u2580"});
+  screen.draw_row(5, 20, 0b1010'0000);
+  test_equal(renderer.encode(screen),
+             std::string_view{"\x1b[3;21H\u2584 \u2584"});
+  screen.draw_row(5, 20, 0b1010'0000);
+  test_equal(renderer.encode(screen), std::string_view{"\x1b[3;21H   "});
+  test_equal(renderer.encode(screen), std::string_view{});
+
+  // One write call per frame.
+  auto const null = ::open("/dev/null", O_WRONLY);
+  auto output     = Renderer{Render_mode::Half_block, null};
+  output.present(screen);
+  output.present(screen);
+  screen.clear();
+  output.present(screen);
+  ::close(null);
+  test_equal(output.stats().frames_presented, std::uint64_t{2});
+  test_equal(output.stats().frames_skipped, std::uint64_t{1});
+  test_equal(output.stats().write_calls, std::uint64_t{2});
+}
+
+// Triple buffer and render thread
+auto test21() -> void
+{
+  {
+    auto buffer = Triple_buffer<int>{};
+    test_equal(buffer.update(), false);
+    buffer.write_buffer() = 1;
+    test_equal(buffer.publish(), true);
+    buffer.write_buffer() = 2;
+    test_equal(buffer.publish(), false);  // 1 was never read.
+    test_equal(buffer.update(), true);
+    test_equal(buffer.read_buffer(), 2);
+    test_equal(buffer.update(), false);
+    test_equal(buffer.read_buffer(), 2);
+  }
+  {
+    // The reader only ever moves forward and ends on the last value.
+    constexpr auto last = 200'000;
+    auto buffer         = Triple_buffer<std::array<int, 64>>{};
+    auto writer         = std::thread{[&buffer] {
+      for (auto i = 1; i <= last; ++i) {
+        buffer.write_buffer().fill(i);
+        buffer.publish();
+      }
+    }};
+    auto seen = 0;
+    while (seen != last) {
+      if (buffer.update()) {
+        auto const& value = buffer.read_buffer();
+        test_equal(value.front() > seen, true);
+        test_equal(value.front(), value.back());
+        seen = value.front();
+      }
+    }
+    writer.join();
+  }
+  {
+    // Every frame is either presented or replaced by a later one, the last
+    // frame is always presented.
+    auto const null = ::open("/dev/null", O_WRONLY);
+    auto screen     = Framebuffer{};
+    auto render     = Render_thread{Renderer{Render_mode::Braille, null}};
+    for (auto i = 0; i < 100; ++i) {
+      screen.draw_row(0, 0, std::uint8_t(i));
+      render.publish(screen);
+    }
+    auto const stats = render.stop();
+    test_equal(stats.frames_presented + stats.frames_dropped,
+               std::uint64_t{100});
+    test_equal(stats.frames_skipped, std::uint64_t{0});
+    ::close(null);
+  }
+}
+
+// Frame paced presentation
+auto test22() -> void
+{
+  auto frame = Present_scheduler{Present_mode::Frame};
+  test_equal(frame.on_tick(), false);
+  test_equal(frame.on_draw(), false);
+  test_equal(frame.on_draw(), false);
+  test_equal(frame.on_tick(), true);
+  test_equal(frame.on_tick(), false);
+
+  auto immediate = Present_scheduler{Present_mode::Immediate};
+  test_equal(immediate.on_draw(), true);
+  test_equal(immediate.on_draw(), true);
+  test_equal(immediate.on_tick(), false);
+
+  test_equal(parse_present_mode("frame") == Present_mode::Frame, true);
+  test_equal(parse_present_mode("immediate") == Present_mode::Immediate, true);
+}
+
+// Braille and sextant renderers
+auto test23() -> void
+{
+  auto const braille_glyph = [](std::size_t tile) {
+    return std::uint32_t(Braille_cell::glyph(tile));
+  };
+  test_equal(braille_glyph(0x00), 0x2800u);
+  test_equal(braille_glyph(0x80), 0x2801u);  // Top left.
+  test_equal(braille_glyph(0x01), 0x2880u);  // Bottom right.
+  test_equal(braille_glyph(0xFF), 0x28FFu);
+
+  auto const sextant_glyph = [](std::size_t tile) {
+    return std::uint32_t(Sextant_cell::glyph(tile));
+  };
+  test_equal(sextant_glyph(0b10'00'00), 0x1FB00u);  // Top left.
+  test_equal(sextant_glyph(0b00'00'01), 0x1FB1Eu);  // Bottom right.
+  test_equal(sextant_glyph(0b01'01'01), 0x2590u);   // Right half block.
+  test_equal(sextant_glyph(0b01'11'11), 0x1FB3Bu);
+  test_equal(sextant_glyph(0b11'11'11), 0x2588u);
+
+  auto screen  = Framebuffer{};
+  auto braille = Renderer{Render_mode::Braille};
+  test_equal(braille.encode(screen).size(), std::size_t{8 * (6 + 32 * 3)});
+  screen.draw_row(0, 0, 0b1100'0000);
+  test_equal(braille.encode(screen), std::string_view{"\x1b[1;1H\u2809"});
+
+  // The last row of sextants covers the last two pixel rows.
+  screen.clear();
+  auto sextant = Renderer{Render_mode::Sextant};
+  test_equal(sextant.encode(screen).size(),
+             std::size_t{9 * 6 + 2 * 7 + 11 * 32});
+  screen.draw_row(31, 0, 0b1000'0000);
+  test_equal(sextant.encode(screen), std::string_view{"\x1b[11;1H\U0001FB03"});
+
+  test_equal(parse_render_mode("sextant") == Render_mode::Sextant, true);
+}
+
+// Sixel renderer, checked against hand encoded frames
+auto test24() -> void
+{
+  auto const header = std::string{
+    "\x1b[1;1H\x1bP0;1;0q\"1;1;64;32#0;2;0;0;0#1;2;100;100;100"};
+  auto screen = Framebuffer{};
+  auto sixel  = Renderer{Render_mode::Sixel, STDOUT_FILENO, 1};
+  // Unlit pixels of every band, the last band is two pixels high.
+  test_equal(sixel.encode(screen),
+             std::string_view{header +
+                              "#0!64~-#0!64~-#0!64~-#0!64~-#0!64~-#0!64B"
+                              "\x1b\\"});
+  test_equal(sixel.encode(screen), std::string_view{});
+
+  // Only the changed band is sent, trailing empty sixels are left out.
+  screen.draw_row(7, 1, 0b1100'0000);
+  test_equal(sixel.encode(screen),
+             std::string_view{header + "-#0~||!61~$#1?AA\x1b\\"});
+
+  screen.clear();
+  screen.draw_row(31, 63, 0b1000'0000);
+  auto scaled = Renderer{Render_mode::Sixel, STDOUT_FILENO, 2};
+  auto expected =
+    std::string{"\x1b[1;1H\x1bP0;1;0q\"1;1;128;64#0;2;0;0;0#1;2;100;100;100"};
+  for (auto band = 0; band < 10; ++band) {
+    expected += "#0!128~-";
+  }
+  expected += "#0!126NBB$#1!126?KK\x1b\\";
+  test_equal(scaled.encode(screen), std::string_view{expected});
+}
+
+// Frame paced scheduling
+auto test25() -> void
+{
+  constexpr auto period = Cycle_scheduler::frame_period;
+  {
+    auto pacing = Cycle_scheduler{};
+    test_equal(pacing.in_budget(), false);
+    pacing.begin_frame();
+    test_equal(pacing.in_budget(), true);
+    pacing.spend(period / 2);
+    test_equal(pacing.in_budget(), true);
+    pacing.spend(period);
+    test_equal(pacing.in_budget(), false);
+    // The overrun is taken out of the next frame.
+    pacing.begin_frame();
+    test_equal(pacing.in_budget(), true);
+    pacing.spend(period / 2);
+    test_equal(pacing.in_budget(), false);
+
+    pacing.begin_frame();
+    pacing.begin_frame();
+    auto const stats = pacing.stats();
+    test_equal(stats.frames, std::uint64_t{4});
+    test_equal(stats.instructions, std::uint64_t{3});
+    test_equal(stats.emulated, 2 * period);
+    test_equal(stats.elapsed >= 3 * period, true);
+    test_equal(stats.resyncs, std::uint64_t{0});
+  }
+  {
+    // Falling further behind than max_lag drops the missed frames.
+    auto pacing = Cycle_scheduler{period};
+    pacing.begin_frame();
+    std::this_thread::sleep_for(3 * period);
+    pacing.begin_frame();
+    auto const resumed = std::chrono::steady_clock::now();
+    pacing.begin_frame();
+    test_equal(std::chrono::steady_clock::now() - resumed >= period / 2, true);
+    test_equal(pacing.stats().resyncs, std::uint64_t{1});
+  }
+}
+
+// Timer modes
+auto test26() -> void
+{
+  // A stopped timer keeps up with the clock, a value written after a long
+  // pause does not count the pause.
+  auto state = initialize_state({});
+  state.delay_timer_register.previous_update -= std::chrono::seconds{1};
+  update_timer(state.delay_timer_register);
+  process_instruction(state, 0x6009);  // LD V0, 9
+  process_instruction(state, 0xF015);  // LD DT, V0
+  update_timer(state.delay_timer_register);
+  test_equal((int)state.delay_timer_register.value, 9);
+
+  state.delay_timer_register.previous_update -= std::chrono::milliseconds{50};
+  update_timer(state.delay_timer_register);
+  test_equal((int)state.delay_timer_register.value, 6);
+
+  tick_timer(state.delay_timer_register);
+  test_equal((int)state.delay_timer_register.value, 5);
+
+  test_equal(parse_timer_mode("cycle") == Timer_mode::Cycle, true);
+  test_equal(parse_timer_mode("wallclock") == Timer_mode::Wall_clock, true);
+}
+
+// Instruction timing
+/// Check that \p backend charges each Dxyn for the x it drew at.
+template <typename Backend_t>
+auto test27_backend(Backend_t backend) -> void
+{
+  // LD VF, 3; DRW VF, V0, 1; ADD VF, 5; JP 0x200
+  auto const program = std::vector<char>{
+    0x6F, 0x03, (char)0xDF, 0x01, 0x7F, 0x05, 0x12, 0x00};
+  auto const vip   = make_clock_fn(std::nullopt);
+  auto state       = initialize_state(program);
+  auto draws       = 0;
+  auto const drawn = [&](Instruction_t instruction) {
+    if ((instruction >> 12) == 0xD) {
+      test_equal(vip(instruction, state.sprite_x), vip(0xDF01, 3));
+      ++draws;
+    }
+  };
+  for (auto i = 0; i < 200; ++i) {
+    backend.run(state, drawn);
+  }
+  test_not_equal(draws, 0);
+}
+
+auto test27() -> void
+{
+  using std::chrono::nanoseconds;
+  auto const fixed = make_clock_fn(500);
+  test_equal(fixed(0x6000, 0), nanoseconds{2'000'000});
+  test_equal(fixed(0xD015, 3), nanoseconds{2'000'000});
+  test_equal(fixed.waits_for_vblank(0xD015), false);
+
+  auto const vip = make_clock_fn(std::nullopt);
+  test_equal(vip(0x6000, 0), 6 * vip_machine_cycle);
+  test_equal(vip(0xF055, 0), 21 * vip_machine_cycle);
+  test_equal(vip(0xFF55, 0), 231 * vip_machine_cycle);
+  // Sprites cost more per row, and more again when not byte aligned.
+  test_equal(vip(0xD011, 8), 43 * vip_machine_cycle);
+  test_equal(vip(0xD015, 16), 111 * vip_machine_cycle);
+  test_equal(vip(0xD015, 17), 191 * vip_machine_cycle);
+  test_equal(vip(0xD015, 23), 311 * vip_machine_cycle);
+  test_equal(vip.waits_for_vblank(0xD015), true);
+  test_equal(vip.waits_for_vblank(0x00E0), false);
+  test_equal(make_clock_fn(0)(0x6000, 0), 6 * vip_machine_cycle);
+
+  // Waiting for vblank spends the rest of the frame.
+  auto pacing = Cycle_scheduler{};
+  pacing.begin_frame();
+  pacing.spend(vip(0x6000, 0));
+  pacing.wait_for_vblank();
+  test_equal(pacing.in_budget(), false);
+  test_equal(pacing.stats().emulated, Cycle_scheduler::frame_period);
+  pacing.wait_for_vblank();
+  test_equal(pacing.stats().emulated, Cycle_scheduler::frame_period);
+
+  // Sprites are charged for the x they were drawn at, whatever Vx holds after.
+  test27_backend(Interpreter{});
+  test27_backend(Decode_cache{});
+  test27_backend(Block_cache{});
+#ifdef CHIP8_JIT
+  test27_backend(Jit{});
+#endif
+#ifdef CHIP8_THREADED
+  test27_backend(Threaded_interpreter{8});
+#endif
+}
+
+// Seeded random numbers
+auto test28() -> void
+{
+  {
+    auto a       = Random_generator{42};
+    auto b       = Random_generator{42};
+    auto c       = Random_generator{43};
+    auto differs = false;
+    for (auto i = 0; i < 16; ++i) {
+      auto const next = a.next();
+      test_equal(b.next(), next);
+      differs = differs || c.next() != next;
+    }
+    test_equal(differs, true);
+  }
+  // LD I, 0x300; RND V0..V3; LD [I], V3; DRW V0, V1, 4; JP 0x20C
+  auto const program = std::vector<char>{
+    (char)0xA3, 0x00, (char)0xC0, (char)0xFF, (char)0xC1, (char)0xFF,
+    (char)0xC2, (char)0xFF, (char)0xC3, (char)0xFF, (char)0xF3, 0x55,
+    (char)0xD0, 0x14, 0x12, 0x0C};
+  auto const run = [&](std::uint64_t seed) {
+    auto state   = initialize_state(program, seed);
+    auto backend = Interpreter{};
+    run_headless(state, backend, 100, 8);
+    return state;
+  };
+  {
+    auto const first = run(7);
+    test_equal_state(run(7), first);
+    test_equal(
+      first.general_purpose_registers == run(8).general_purpose_registers,
+      false);
+  }
+  {
+    auto options    = Batch_options{100, 8, 7, 2, 7};
+    auto const jobs = std::vector<Batch_job>{batch_job("a", program),
+                                             batch_job("b", program),
+                                             batch_job("c", program, 42)};
+    auto const results =
+      run_batch(jobs, options, [] { return Decode_cache{}; });
+    test_equal(results[0].framebuffer_hash, framebuffer_hash(run(7)));
+    test_equal(results[1].framebuffer_hash, framebuffer_hash(run(8)));
+    test_equal(results[2].framebuffer_hash, framebuffer_hash(run(42)));
+    test_equal(results[2].seed.value_or(0), std::uint64_t{42});
+
+    auto summary = std::ostringstream{};
+    write_summary(summary, results);
+    test_equal(summary.str().find("\nb\t8\t100\t") != std::string::npos,
+               true);
+    options.seed = std::nullopt;
+    test_equal(run_batch(jobs, options, [] { return Decode_cache{}; })[0]
+                 .seed.has_value(),
+               false);
+  }
+  {
+    auto batch = Lockstep_batch<8>{program, 7};
+    batch.run(100, 8);
+    for (auto lane = std::size_t{0}; lane < 8; ++lane) {
+      test_equal_state(batch.state(lane), run(7 + lane));
+    }
+  }
+}
+
+// Held keys and the keyboard
+auto test29() -> void
+{
+  using std::chrono::milliseconds;
+  test_equal(host_key(esc::Key::p) == Host_key::Save_state, true);
+  test_equal(host_key(esc::Key::Backspace) == Host_key::Rewind, true);
+  test_equal(host_key(esc::Key::q).has_value(), false);
+  {
+    auto const start = Clock_t::now();
+    auto held        = Held_keys{milliseconds{75}};
+    test_equal(held.next_release(start, milliseconds{50}), milliseconds{50});
+    held.press(0x5, start);
+    held.press(0xA, start + milliseconds{40});
+    test_equal((int)held.mask(), 0x0420);
+    test_equal(held.next_release(start, milliseconds{50}), milliseconds{50});
+    test_equal(held.next_release(start + milliseconds{30}, milliseconds{50}),
+               milliseconds{45});
+    // Keys are released independently.
+    held.expire(start + milliseconds{80});
+    test_equal((int)held.mask(), 0x0400);
+    held.press(0xA, start + milliseconds{100});
+    held.expire(start + milliseconds{150});
+    test_equal((int)held.mask(), 0x0400);
+    held.release(0xA);
+    test_equal((int)held.mask(), 0x0000);
+  }
+  {
+    auto keys  = std::atomic<Key_mask>{0};
+    auto state = initialize_state({});
+    auto& reg  = state.general_purpose_registers;
+    reg[0x0]   = 0x5;
+    reg[0x1]   = 0xA;
+    reg[0x2]   = 0x15;
+    test_equal(state.keyboard.is_pressed(0x5), false);
+    state.keyboard.attach(keys);
+    keys = 0x0420;
+    test_equal(state.keyboard.is_pressed(0x5), true);
+    test_equal(state.keyboard.is_pressed(0xA), true);
+    test_equal(state.keyboard.is_pressed(0x15), false);
+    auto const next = [&](Instruction_t instruction) {
+      state.program_counter = 0x200;
+      return (int)process_instruction(state, instruction);
+    };
+    test_equal(next(0xE09E), 0x204);
+    test_equal(next(0xE19E), 0x204);
+    test_equal(next(0xE29E), 0x202);
+    test_equal(next(0xE0A1), 0x202);
+    test_equal(next(0xE2A1), 0x204);
+    test_equal((int)*state.keyboard.get_key(), 0x5);
+
+    state.keyboard.detach();
+    test_equal(state.keyboard.is_pressed(0xA), false);
+  }
+  {
+    // No terminal input, the thread starts and stops.
+    auto input = Input_thread{};
+    test_equal((int)input.keys().load(), 0);
+    input.stop();
+  }
+}
+
+// Fx0A wait state
+template <typename Backend_t>
+auto test30_backend() -> void
+{
+  // LD V3, K; JP 0x202
+  auto keys    = std::atomic<Key_mask>{0};
+  auto state   = initialize_state({(char)0xF3, 0x0A, 0x12, 0x02});
+  auto backend = Backend_t{};
+  auto count   = 0;
+  state.keyboard.attach(keys);
+  for (auto i = 0; i < 3; ++i) {
+    backend.run(state, [&](Instruction_t) { ++count; });
+    test_equal((int)state.program_counter, 0x200);
+    test_equal(state.waiting_for_key, true);
+  }
+  keys = 0x0180;
+  backend.run(state, [&](Instruction_t) { ++count; });
+  test_equal((int)state.general_purpose_registers[0x3], 0x7);
+  test_equal(state.waiting_for_key, false);
+  test_equal((int)state.program_counter, 0x202);
+  test_equal(count >= 4, true);
+}
+
+auto test30() -> void
+{
+  test30_backend<Interpreter>();
+  test30_backend<Decode_cache>();
+  test30_backend<Block_cache>();
+#ifdef CHIP8_JIT
+  test30_backend<Jit>();
+#endif
+#ifdef CHIP8_THREADED
+  test30_backend<Threaded_interpreter>();
+#endif
+
+  // With no keyboard the wait never ends, a headless run halts.
+  auto state        = initialize_state({(char)0xF0, 0x0A});
+  auto backend      = Interpreter{};
+  auto const report = run_headless(state, backend, 100, 8);
+  test_equal(report.halt_reason, std::string{"waiting for a keypress"});
+}
+
+// Idle loop detection
+template <typename Backend_t>
+auto test31_backend(std::vector<char> const& program, Backend_t backend)
+  -> void
+{
+  // Step by step, timers ticking every 8 instructions.
+  auto expected = initialize_state(program);
+  for (auto i = 1; i <= 1000; ++i) {
+    auto const instruction = *get_instruction(expected);
+    expected.program_counter = process_instruction(expected, instruction);
+    if (i % 8 == 0) {
+      tick_timer(expected.delay_timer_register);
+      tick_timer(expected.sound_timer_register);
+    }
+  }
+  auto state        = initialize_state(program);
+  auto const report = run_headless(state, backend, 1000, 8);
+  test_equal(report.instructions, std::uint64_t{1000});
+  test_equal(report.frames, std::uint64_t{125});
+  test_equal_state(state, expected);
+  test_equal((int)state.delay_timer_register.value,
+             (int)expected.delay_timer_register.value);
+}
+
+auto test31() -> void
+{
+  auto const idle_loop = [](std::vector<char> const& program,
+                            std::uint8_t delay) {
+    auto state                         = initialize_state(program);
+    state.delay_timer_register.value   = delay;
+    state.general_purpose_registers[0] = delay;
+    return find_idle_loop(state);
+  };
+  // JP 0x200
+  test_equal(*idle_loop({0x12, 0x00}, 0), std::size_t{1});
+  // LD V0, DT; SE V0, 0; JP 0x200
+  auto const poll = std::vector<char>{(char)0xF0, 0x07, 0x30, 0x00, 0x12, 0x00};
+  test_equal(*idle_loop(poll, 3), std::size_t{3});
+  test_equal(idle_loop(poll, 0).has_value(), false);
+  // ADD V0, 1; JP 0x200
+  test_equal(idle_loop({0x70, 0x01, 0x12, 0x00}, 0).has_value(), false);
+  // SKNP V0; JP 0x206; JP 0x200
+  auto const keys =
+    std::vector<char>{(char)0xE0, (char)0xA1, 0x12, 0x06, 0x12, 0x00};
+  test_equal(*idle_loop(keys, 0), std::size_t{2});
+
+  // Idle loops are skipped without changing the outcome of a headless run.
+  // LD V0, 5; LD DT, V0; LD V2, DT; SE V2, 0; JP 0x204; ADD V1, 1; JP 0x202
+  auto const program = std::vector<char>{
+    0x60, 0x05, (char)0xF0, 0x15, (char)0xF2, 0x07, 0x32,
+    0x00, 0x12, 0x04, 0x71, 0x01, 0x12, 0x02};
+  test31_backend(program, Interpreter{});
+  test31_backend(program, Decode_cache{});
+  test31_backend(program, Block_cache{});
+#ifdef CHIP8_JIT
+  test31_backend(program, Jit{});
+#endif
+#ifdef CHIP8_THREADED
+  test31_backend(program, Threaded_interpreter{8});
+#endif
+  test31_backend({0x12, 0x00}, Decode_cache{});
+}
+
+// Save states
+auto test32() -> void
+{
+  // LD I, 0x300; RND V0..V3; LD [I], V3; DRW V0, V1, 4; LD DT, V2; JP 0x202
+  auto const program = std::vector<char>{
+    (char)0xA3, 0x00, (char)0xC0, (char)0xFF, (char)0xC1, (char)0xFF,
+    (char)0xC2, (char)0xFF, (char)0xC3, (char)0xFF, (char)0xF3, 0x55,
+    (char)0xD0, 0x14, (char)0xF2, 0x15, 0x12, 0x02};
+  auto const check_equal = [](State const& a, State const& b) {
+    test_equal_state(a, b);
+    test_equal(a.screen_buffer == b.screen_buffer, true);
+    test_equal(a.random_generator == b.random_generator, true);
+    test_equal((int)a.delay_timer_register.value,
+               (int)b.delay_timer_register.value);
+    test_equal(a.waiting_for_key, b.waiting_for_key);
+  };
+
+  auto state   = initialize_state(program, 3);
+  auto backend = Interpreter{};
+  run_headless(state, backend, 96, 8);
+  state.sound_timer_register.value = 0x42;
+  state.waiting_for_key            = true;
+  state.stack_pointer              = 2;
+  state.instruction_stack[1]       = 0x234;
+  state.instruction_stack[2]       = 0x456;
+
+  auto const saved = encode_state(state);
+  test_equal(saved.size(), save_state_size);
+  auto loaded = initialize_state({});
+  decode_state(saved, loaded);
+  check_equal(loaded, state);
+  test_equal((int)loaded.sound_timer_register.value, 0x42);
+
+  // A damaged or foreign save state is rejected and changes nothing.
+  auto const rejected = [&](std::span<std::uint8_t const> buffer) {
+    auto target = initialize_state({}, 0);
+    try {
+      decode_state(buffer, target);
+    }
+    catch (std::runtime_error const&) {
+      check_equal(target, initialize_state({}, 0));
+      return true;
+    }
+    return false;
+  };
+  for (auto const at : {std::size_t{0}, std::size_t{4}, std::size_t{100},
+                        save_state_size - 1}) {
+    auto damaged = saved;
+    damaged[at] ^= 0x10;
+    test_equal(rejected(damaged), true);
+  }
+  test_equal(rejected(std::span{saved}.first(save_state_size - 1)), true);
+
+  // An intact save state with a stack pointer past the stack is rejected.
+  {
+    auto damaged = saved;
+    damaged[detail::save_state_stack_pointer] = 16;
+    auto const payload = std::span{damaged}.subspan(
+      detail::save_state_header,
+      save_state_size - detail::save_state_header - 8);
+    detail::Save_state_writer{damaged.data() + save_state_size - 8}.put(
+      detail::save_state_hash(payload));
+    test_equal(rejected(damaged), true);
+  }
+
+  // Resuming from a file matches an uninterrupted run.
+  auto const path =
+    (std::filesystem::temp_directory_path() / "chip8_test32.state").string();
+  save_state(state, path);
+  auto resumed = initialize_state(program);
+  load_state(path, resumed);
+  std::filesystem::remove(path);
+  state.waiting_for_key   = false;
+  resumed.waiting_for_key = false;
+  run_headless(state, backend, 96, 8);
+  auto other = Interpreter{};
+  run_headless(resumed, other, 96, 8);
+  check_equal(resumed, state);
+
+  // A batch job saves its State at the end, another resumes from it.
+  {
+    auto const job_path =
+      (std::filesystem::temp_directory_path() / "chip8_test32.job").string();
+    auto options = Batch_options{96, 8, 7, 2, std::nullopt};
+    auto first   = batch_job("first", program, 3);
+    first.save_state_filepath = job_path;
+    auto const make_backend   = [] { return Decode_cache{}; };
+    test_equal(run_batch({first}, options, make_backend)[0].report.halt_reason,
+               std::string{});
+    auto second          = batch_job("second", program);
+    second.initial_state = read_state(job_path);
+    std::filesystem::remove(job_path);
+    auto const result = run_batch({second}, options, make_backend)[0];
+
+    auto expected = initialize_state(program, 3);
+    auto backend  = Interpreter{};
+    run_headless(expected, backend, 192, 8);
+    test_equal(result.framebuffer_hash, framebuffer_hash(expected));
+
+    first.save_state_filepath = "/nonexistent/chip8_test32.job";
+    test_not_equal(
+      run_batch({first}, options, make_backend)[0].report.halt_reason,
+      std::string{});
+  }
+}
+
+// Rewind buffer
+auto test33() -> void
+{
+  // LD I, 0x300; RND V0..V3; LD [I], V3; DRW V0, V1, 4; LD DT, V2; JP 0x202
+  auto const program = std::vector<char>{
+    (char)0xA3, 0x00, (char)0xC0, (char)0xFF, (char)0xC1, (char)0xFF,
+    (char)0xC2, (char)0xFF, (char)0xC3, (char)0xFF, (char)0xF3, 0x55,
+    (char)0xD0, 0x14, (char)0xF2, 0x15, 0x12, 0x02};
+  auto const run_frames = [&](Rewind_buffer& rewind, int frames) {
+    auto state   = initialize_state(program, 5);
+    auto backend = Interpreter{};
+    auto history = std::vector<Save_state_t>{};
+    auto report  = Headless_report{};
+    for (auto frame = 1; frame <= frames; ++frame) {
+      resume_headless(state, backend, report, frame * 8u, 8);
+      rewind.capture(state);
+      history.push_back(encode_state(state));
+    }
+    return std::pair{state, history};
+  };
+  {
+    auto rewind           = Rewind_buffer{};
+    auto [state, history] = run_frames(rewind, 12);
+    test_equal(rewind.frames(), std::size_t{11});
+    test_equal(rewind.bytes_used() < 11 * save_state_size / 4, true);
+
+    test_equal(rewind.rewind(0, state), std::size_t{0});
+    test_equal(encode_state(state) == history[11], true);
+    test_equal(rewind.rewind(3, state), std::size_t{3});
+    test_equal(encode_state(state) == history[8], true);
+    test_equal(rewind.rewind(1, state), std::size_t{1});
+    test_equal(encode_state(state) == history[7], true);
+
+    // Capturing after a rewind continues from the restored frame.
+    rewind.capture(state);
+    test_equal(rewind.frames(), std::size_t{8});
+    test_equal(rewind.rewind(100, state), std::size_t{8});
+    test_equal(encode_state(state) == history[0], true);
+    test_equal(rewind.frames(), std::size_t{0});
+  }
+  {
+    // A full ring forgets the oldest frames.
+    auto rewind           = Rewind_buffer{600};
+    auto [state, history] = run_frames(rewind, 40);
+    test_equal(rewind.bytes_used() <= 600, true);
+    auto const frames = rewind.frames();
+    test_equal(frames > 0 && frames < 39, true);
+    test_equal(rewind.rewind(1000, state), frames);
+    test_equal(encode_state(state) == history[39 - frames], true);
+  }
+  {
+    auto rewind = Rewind_buffer{};
+    auto state  = initialize_state({});
+    test_equal(rewind.rewind(1, state), std::size_t{0});
+  }
+  {
+    // ADD V2, 1; LD V0, 0x73; LD V1, V2; LD I, 0x20A; LD [I], V1;
+    // ADD V3, V2 (written by the LD [I] before it); JP 0x200
+    auto const modifying = std::vector<char>{
+      0x72, 0x01, 0x60, 0x73, (char)0x81, 0x20, (char)0xA2, 0x0A,
+      (char)0xF1, 0x55, 0x00, 0x00, 0x12, 0x00};
+    // Five instructions a frame, so the first frame ends on the written code.
+    auto const run_rewound = [&]<typename Backend_t>(Backend_t backend) {
+      auto state        = initialize_state(modifying);
+      auto rewind       = Rewind_buffer{};
+      auto const frames = [&](int count) {
+        for (auto frame = 0; frame < count; ++frame) {
+          for (auto i = 0; i < 5; ++i) {
+            backend.run(state, [](Instruction_t) {});
+          }
+          rewind.capture(state);
+        }
+      };
+      frames(12);
+      rewind.rewind(11, state);
+      test_equal(state.program_counter, Address_t{0x20A});
+      backend.clear();
+      frames(12);
+      return state;
+    };
+    auto const expected = run_rewound(Interpreter{});
+    test_equal_state(run_rewound(Decode_cache{}), expected);
+  }
+}
+
+// Movie recording and replay
+auto test34() -> void
+{
+  // RND V0, 0xFF; SKP V1; ADD V2, 1; LD V3, K; DRW V0, V1, 4; LD DT, V3;
+  // JP 0x200
+  auto const program = std::vector<char>{
+    (char)0xC0, (char)0xFF, (char)0xE1, (char)0x9E, 0x72, 0x01,
+    (char)0xF3, 0x0A, (char)0xD0, 0x14, (char)0xF3, 0x15, 0x12, 0x00};
+  // Stand in for an interactive run: frames run a varying number of
+  // instructions, or until Fx0A waits, with the keys changing between them.
+  auto const record = [&](std::ostream& output, int frames) {
+    auto live     = std::atomic<Key_mask>{0};
+    auto state    = initialize_state(program, 42);
+    auto backend  = Interpreter{};
+    auto recorder = Movie_recorder{output, live, 42, program, 4};
+    recorder.attach(state);
+    for (auto frame = 0; frame < frames; ++frame) {
+      live.store(Key_mask((frame % 3 == 0) << (frame % 16)));
+      recorder.begin_frame();
+      for (auto i = 0; i < 3 + frame % 5 && !state.waiting_for_key; ++i) {
+        backend.run(state, [&](Instruction_t) { recorder.on_executed(); });
+      }
+      tick_timer(state.delay_timer_register);
+      tick_timer(state.sound_timer_register);
+      recorder.end_frame(state);
+    }
+    test_equal(recorder.frames(), std::uint64_t(frames));
+    return encode_state(state);
+  };
+  auto output = std::stringstream{};
+  auto const recorded = record(output, 30);
+  auto const bytes    = output.str();
+
+  auto input       = std::istringstream{bytes};
+  auto const movie = read_movie(input);
+  test_equal(movie.seed, std::uint64_t{42});
+  test_equal(movie.program_hash, program_hash(program));
+  test_equal(movie.frames.size(), std::size_t{30});
+  test_equal(movie.frames[3].framebuffer_hash.has_value(), true);
+  test_equal(movie.frames[4].framebuffer_hash.has_value(), false);
+
+  // Every backend replays to the recorded State.
+  auto const replay = [&](Movie const& movie, auto backend) {
+    auto state        = initialize_state(program, movie.seed);
+    auto const report = replay_movie(movie, state, backend);
+    return std::pair{report, encode_state(state)};
+  };
+  {
+    auto const [report, state] = replay(movie, Interpreter{});
+    test_equal(report.diverged_at.has_value(), false);
+    test_equal(report.checkpoints, std::uint64_t{7});
+    test_equal(report.run.frames, std::uint64_t{30});
+    test_equal(state == recorded, true);
+  }
+  test_equal(replay(movie, Decode_cache{}).second == recorded, true);
+
+  // A wrong checkpoint is reported at its frame.
+  {
+    auto changed = movie;
+    *changed.frames[11].framebuffer_hash ^= 1;
+    auto const [report, state] = replay(changed, Interpreter{});
+    test_equal(report.diverged_at.value_or(0), std::uint64_t{11});
+    test_equal(report.checkpoints, std::uint64_t{2});
+  }
+
+  // A recording cut off mid frame drops that frame.
+  {
+    auto cut = std::istringstream{bytes.substr(0, bytes.size() - 3)};
+    test_equal(read_movie(cut).frames.size(), std::size_t{29});
+    auto wrong = std::istringstream{"CH8S" + bytes.substr(4)};
+    auto threw = false;
+    try {
+      read_movie(wrong);
+    }
+    catch (std::runtime_error const&) {
+      threw = true;
+    }
+    test_equal(threw, true);
+  }
+
+  // A program that halts is replayed to the halt.
+  {
+    // ADD V0, 1; SE V0, 5; JP 0x200; JP 0xFFF
+    auto const halting = std::vector<char>{
+      0x70, 0x01, 0x30, 0x05, 0x12, 0x00, 0x1F, (char)0xFF};
+    auto output   = std::stringstream{};
+    auto live     = std::atomic<Key_mask>{0};
+    auto state    = initialize_state(halting, 7);
+    auto backend  = Interpreter{};
+    auto recorder = Movie_recorder{output, live, 7, halting};
+    recorder.attach(state);
+    auto running = true;
+    while (running) {
+      recorder.begin_frame();
+      for (auto i = 0; i < 4 && running; ++i) {
+        running =
+          backend.run(state, [&](Instruction_t) { recorder.on_executed(); });
+      }
+      recorder.end_frame(state, !running);
+    }
+    auto input       = std::istringstream{output.str()};
+    auto const movie = read_movie(input);
+    test_equal(movie.frames.back().halted, true);
+    auto replayed     = initialize_state(halting, movie.seed);
+    auto other        = Decode_cache{};
+    auto const report = replay_movie(movie, replayed, other);
+    test_equal(report.diverged_at.has_value(), false);
+    test_equal(report.run.halt_reason, std::string{"invalid program counter"});
+    test_equal(encode_state(replayed) == encode_state(state), true);
+  }
+}
+
 auto main() -> int
 {
   test01();
@@ -357,6 +1678,34 @@ auto main() -> int
   test08();
   test09();
   test10();
+  test11();
+  test12();
+#ifdef CHIP8_JIT
+  test13();
+#endif
+  test14();
+#ifdef CHIP8_THREADED
+  test15();
+#endif
+  test16();
+  test17();
+  test18();
+  test19();
+  test20();
+  test21();
+  test22();
+  test23();
+  test24();
+  test25();
+  test26();
+  test27();
+  test28();
+  test29();
+  test30();
+  test31();
+  test32();
+  test33();
+  test34();
 
   return 0;
 }